@@ -0,0 +1,136 @@
+/*
+ * camera pantilt controller
+ *
+ * Copyright (c) Thomas Schmid, 2021
+ *
+ * Authors:
+ *  Thomas Schmid <tom@lfence.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 3.  See
+ * the LICENSE file in the top-level directory.
+ */
+
+#include <zephyr.h>
+#include <stdlib.h>
+#include <math.h>
+#include "axis.h"
+
+/* quadratic for fine control at low levels, permille of the top speed */
+#define AXIS_CURVE(l) ((l) * (l) * 1000 / (AXIS_SPEED_LEVELS * AXIS_SPEED_LEVELS))
+
+static const uint16_t axis_speed_curve[AXIS_SPEED_LEVELS + 1] = {
+	AXIS_CURVE(0),	AXIS_CURVE(1),	AXIS_CURVE(2),	AXIS_CURVE(3),
+	AXIS_CURVE(4),	AXIS_CURVE(5),	AXIS_CURVE(6),	AXIS_CURVE(7),
+	AXIS_CURVE(8),	AXIS_CURVE(9),	AXIS_CURVE(10), AXIS_CURVE(11),
+	AXIS_CURVE(12), AXIS_CURVE(13), AXIS_CURVE(14), AXIS_CURVE(15),
+	AXIS_CURVE(16), AXIS_CURVE(17), AXIS_CURVE(18), AXIS_CURVE(19),
+	AXIS_CURVE(20), AXIS_CURVE(21), AXIS_CURVE(22), AXIS_CURVE(23),
+	AXIS_CURVE(24),
+};
+
+BUILD_ASSERT(ARRAY_SIZE(axis_speed_curve) == AXIS_SPEED_LEVELS + 1);
+
+/* a / b rounded to nearest */
+static int32_t axis_div(int64_t a, int64_t b)
+{
+	if (b < 0) {
+		a = -a;
+		b = -b;
+	}
+
+	return (a + (a < 0 ? -b : b) / 2) / b;
+}
+
+/* Limit a VISCA position to the range of the axis, true if it was off */
+bool axis_clamp(const struct axis *axis, int32_t *visca)
+{
+	int32_t clamped = CLAMP(*visca, axis->min, axis->max);
+	bool changed = clamped != *visca;
+
+	*visca = clamped;
+	return changed;
+}
+
+int32_t axis_to_machine(const struct axis *axis, int32_t visca)
+{
+	return axis->center + axis_div(visca * axis->num, axis->den);
+}
+
+int32_t axis_to_visca(const struct axis *axis, int32_t machine)
+{
+	return axis_div((int64_t)(machine - axis->center) * axis->den,
+			axis->num);
+}
+
+/* Feed for a VISCA speed level, negative if the axis is inverted */
+int32_t axis_feed(const struct axis *axis, uint8_t speed)
+{
+	int32_t level = CLAMP(speed, 1, axis->speed_levels);
+	int32_t feed = (int64_t)axis->max_feed *
+		       axis_speed_curve[level * AXIS_SPEED_LEVELS /
+					axis->speed_levels] /
+		       1000;
+
+	return axis->num < 0 ? -feed : feed;
+}
+
+/*
+ * Feed along a straight move by delta_a and delta_b (machine units) so
+ * that neither axis is faster than its speed level allows.
+ */
+int32_t axis_path_feed(const struct axis *a, uint8_t speed_a, int32_t delta_a,
+		       const struct axis *b, uint8_t speed_b, int32_t delta_b)
+{
+	int64_t distance = axis_isqrt((int64_t)delta_a * delta_a +
+				      (int64_t)delta_b * delta_b);
+	int64_t feed = INT32_MAX;
+
+	if (delta_a != 0) {
+		feed = MIN(feed, abs(axis_feed(a, speed_a)) * distance /
+					 abs(delta_a));
+	}
+
+	if (delta_b != 0) {
+		feed = MIN(feed, abs(axis_feed(b, speed_b)) * distance /
+					 abs(delta_b));
+	}
+
+	return feed;
+}
+
+/* grbl reports positions as float, everything else works in 1/1000 units */
+int32_t axis_get(const struct axis *axis, const struct Position *pos)
+{
+	return lroundf((axis->grbl_axis == 0 ? pos->x : pos->y) * 1000);
+}
+
+void axis_put(const struct axis *axis, struct Position *pos, int32_t machine)
+{
+	if (axis->grbl_axis == 0) {
+		pos->x = machine / 1000.0f;
+	} else {
+		pos->y = machine / 1000.0f;
+	}
+}
+
+uint32_t axis_isqrt(uint64_t value)
+{
+	uint64_t root = 0;
+	uint64_t bit = 1ULL << 62;
+
+	while (bit > value) {
+		bit >>= 2;
+	}
+
+	while (bit != 0) {
+		if (value >= root + bit) {
+			value -= root + bit;
+			root = (root >> 1) + bit;
+		} else {
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+
+	return root;
+}
@@ -0,0 +1,69 @@
+#ifndef CAMPANTILT__AXIS__H
+#define CAMPANTILT__AXIS__H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <devicetree.h>
+#include "grbl.h"
+
+/* highest VISCA pan speed level, tilt only goes up to 0x14 */
+#define AXIS_SPEED_LEVELS 0x18
+
+/*
+ * Conversion of one head axis between VISCA units and grbl machine units.
+ * Machine positions and feeds are kept in 1/1000 units, all factors are
+ * derived from the devicetree at compile time so converting only takes
+ * integer math.
+ */
+struct axis {
+	uint8_t grbl_axis;
+	uint8_t speed_levels;
+	/* machine units per VISCA unit is num / den, negative if inverted */
+	int64_t num;
+	int64_t den;
+	/* machine position of VISCA position 0 */
+	int32_t center;
+	/* VISCA units */
+	int16_t min, max;
+	/* at the highest speed level, 1/1000 units per minute */
+	int32_t max_feed;
+};
+
+/* 1/1000 machine units per degree of the head, as a fraction */
+#define AXIS_UNITS_NUM(n, name)                                                \
+	((int64_t)DT_INST_PROP(n, name##_steps_per_rev) *                      \
+	 DT_INST_PROP_BY_IDX(n, name##_gear_ratio, 0) * 1000 * 1000)
+#define AXIS_UNITS_DEN(n, name)                                                \
+	((int64_t)360 * DT_INST_PROP_BY_IDX(n, name##_gear_ratio, 1) *         \
+	 DT_INST_PROP(n, name##_grbl_steps_per_unit))
+
+#define AXIS_VISCA_LIMIT(n, name, idx)                                         \
+	((int32_t)DT_INST_PROP_BY_IDX(n, name##_limits, idx) * 1000 /          \
+	 CONFIG_CAMERAPANTILT_VISCA_MILLIDEG_PER_UNIT)
+
+#define AXIS_DT_INST(n, name, levels)                                          \
+	{                                                                      \
+		.grbl_axis = DT_INST_PROP(n, name##_axis),                     \
+		.speed_levels = levels,                                        \
+		.num = (DT_INST_PROP(n, name##_inverted) ? -1 : 1) *           \
+		       CONFIG_CAMERAPANTILT_VISCA_MILLIDEG_PER_UNIT *          \
+		       AXIS_UNITS_NUM(n, name) / 1000,                         \
+		.den = AXIS_UNITS_DEN(n, name),                                \
+		.center = (int32_t)DT_INST_PROP(n, name##_center),             \
+		.min = AXIS_VISCA_LIMIT(n, name, 0),                           \
+		.max = AXIS_VISCA_LIMIT(n, name, 1),                           \
+		.max_feed = DT_INST_PROP(n, name##_max_speed) * 60 *           \
+			    AXIS_UNITS_NUM(n, name) / AXIS_UNITS_DEN(n, name), \
+	}
+
+bool axis_clamp(const struct axis *axis, int32_t *visca);
+int32_t axis_to_machine(const struct axis *axis, int32_t visca);
+int32_t axis_to_visca(const struct axis *axis, int32_t machine);
+int32_t axis_feed(const struct axis *axis, uint8_t speed);
+int32_t axis_path_feed(const struct axis *a, uint8_t speed_a, int32_t delta_a,
+		       const struct axis *b, uint8_t speed_b, int32_t delta_b);
+int32_t axis_get(const struct axis *axis, const struct Position *pos);
+void axis_put(const struct axis *axis, struct Position *pos, int32_t machine);
+uint32_t axis_isqrt(uint64_t value);
+
+#endif
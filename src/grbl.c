@@ -1,313 +1,674 @@
 #include "grbl.h"
+#include "grbl_parser.h"
 #include "zephyr.h"
 #include <string.h>
 #include <logging/log.h>
 #include <drivers/uart.h>
 #include <sys/ring_buffer.h>
 #include <stdlib.h>
+#include <math.h>
 
 LOG_MODULE_REGISTER(grbl, CONFIG_LOG_DEFAULT_LEVEL);
 
-RING_BUF_DECLARE(grbl_tx_buf, 512);
-RING_BUF_DECLARE(grbl_rx_buf, 512);
-
-K_FIFO_DEFINE(grbl_cmd_fifo);
-K_FIFO_DEFINE(grbl_receive_fifo);
-
-K_CONDVAR_DEFINE(grbl_new_response_condvar);
-K_MUTEX_DEFINE(grbl_cmd_mutex);
-
-K_THREAD_STACK_DEFINE(grbl_receive_stack, 2048);
-
-/* This timer sends a regular status report realtime command to grbl */
-static void grbl_report_timer_expr(struct k_timer *dummy);
-K_TIMER_DEFINE(report_timer, grbl_report_timer_expr, NULL);
-
-static const struct device *grbl_dev;
-struct k_thread grbl_receive_thread_data;
-
-struct WorkOffset {
-	int wco_num;
-	struct Position offset;
-};
-
-struct GrblState currentState = { 0 };
-
-static struct WorkOffset workOffsets[5] = { 0 };
-
-enum grbl_message {
-	GRBL_OK,
-	GRBL_REPORT,
-	GRBL_ERROR,
-	GRBL_ALARM,
-	GRBL_FEEDBACK,
-	GRBL_SETTINGS,
-	GRBL_STARTUP_EXEC,
-	GRBL_WELCOME,
-	GRBL_INVALID
-};
-
-static const char *const msg_prefix[] = {
-	[GRBL_OK] = "ok",	   [GRBL_REPORT] = "<",
-	[GRBL_ERROR] = "error:",   [GRBL_ALARM] = "Alarm:",
-	[GRBL_FEEDBACK] = "[",	   [GRBL_SETTINGS] = "$",
-	[GRBL_STARTUP_EXEC] = ">", [GRBL_WELCOME] = "Grbl"
-};
-
-static const char *const state_str[] = {
-	[GRBL_STATE_IDLE] = "Idle",   [GRBL_STATE_RUN] = "Run",
-	[GRBL_STATE_HOLD] = "Hold",   [GRBL_STATE_JOG] = "Jog",
-	[GRBL_STATE_ALARM] = "Alarm", [GRBL_STATE_DOOR] = "Door",
-	[GRBL_STATE_CHECK] = "Check", [GRBL_STATE_HOME] = "Home",
-	[GRBL_STATE_SLEEP] = "Sleep"
-};
-
-static void grbl_uart_irq_tx(const struct device *dev)
+/* character counting keeps at most the rx buffer of grbl in flight */
+BUILD_ASSERT(GRBL_TX_RING_SIZE > GRBL_RX_BUFFER_SIZE,
+	     "grbl tx ring can't hold the lines in flight");
+
+static void grbl_uart_irq_tx(struct grbl_ctx *grbl)
 {
 	uint8_t *data_start;
 	uint32_t bsend = 0;
-	uint32_t bsize = ring_buf_get_claim(&grbl_tx_buf, &data_start, 512);
+	uint32_t bsize = ring_buf_get_claim(&grbl->tx_buf, &data_start,
+					    GRBL_TX_RING_SIZE);
 
 	if (bsize == 0) {
-		uart_irq_tx_disable(dev);
+		uart_irq_tx_disable(grbl->uart);
 	} else {
-		bsend = uart_fifo_fill(dev, data_start, bsize);
+		bsend = uart_fifo_fill(grbl->uart, data_start, bsize);
 	}
-	ring_buf_get_finish(&grbl_tx_buf, bsend);
+	ring_buf_get_finish(&grbl->tx_buf, bsend);
 }
 
-static void parse_position(const char *msg, float *x, float *y, float *z)
+static void grbl_receive_char(struct grbl_ctx *grbl, char c)
 {
-	char *endPtr;
-	*x = strtof(msg, &endPtr);
-	*y = strtof(endPtr + 1, &endPtr);
-	*z = strtof(endPtr + 1, NULL);
-}
+	if (grbl->line == NULL) {
+		if (grbl->line_dropped ||
+		    k_mem_slab_alloc(&grbl->line_slab, (void **)&grbl->line,
+				     K_NO_WAIT) != 0) {
+			/* the receive thread is behind, lose the whole line */
+			if (!grbl->line_dropped) {
+				LOG_ERR("receive queue full. Dropping line");
+			}
+			grbl->line = NULL;
+			grbl->line_dropped = c != '\n';
+			return;
+		}
 
-static void grbl_uart_irq_rx(const struct device *dev)
-{
-	uint8_t *buffer;
-	static char line_buffer[128] = { 0 };
-	static uint8_t line_buffer_pos = 0;
+		grbl->line_pos = 0;
+		grbl->lines_peak =
+			MAX(grbl->lines_peak,
+			    k_mem_slab_num_used_get(&grbl->line_slab));
+	}
 
-	uint32_t bsize = ring_buf_put_claim(&grbl_rx_buf, &buffer, 512);
-	int rsize = uart_fifo_read(dev, buffer, bsize);
-	ring_buf_put_finish(&grbl_rx_buf, rsize);
+	if (c == '\n') {
+		if (grbl->line_pos > 0 &&
+		    grbl->line->text[grbl->line_pos - 1] == '\r') {
+			grbl->line_pos--;
+		}
 
-	uint32_t numreceived = ring_buf_get_claim(&grbl_rx_buf, &buffer, 512);
+		grbl->line->text[grbl->line_pos] = 0;
+		k_fifo_put(&grbl->receive_fifo, grbl->line);
+		grbl->line = NULL;
+		return;
+	}
 
-	int i = 0;
-	for (i = 0; i < numreceived; i++) {
-		line_buffer[line_buffer_pos] = buffer[i];
-		line_buffer_pos++;
+	/* overlong lines are truncated */
+	if (grbl->line_pos < GRBL_LINE_SIZE - 1) {
+		grbl->line->text[grbl->line_pos++] = c;
+	}
+}
 
-		if (line_buffer_pos >= ARRAY_SIZE(line_buffer)) {
-			line_buffer_pos = 0;
-		}
+static void grbl_uart_irq_rx(struct grbl_ctx *grbl)
+{
+	uint8_t *buffer;
 
-		if (buffer[i] == '\n') {
-			char *line = k_malloc(line_buffer_pos);
+	uint32_t bsize =
+		ring_buf_put_claim(&grbl->rx_buf, &buffer, GRBL_RX_RING_SIZE);
+	int rsize = uart_fifo_read(grbl->uart, buffer, bsize);
+	ring_buf_put_finish(&grbl->rx_buf, rsize);
 
-			if (line == NULL) {
-				LOG_ERR("unable to allocate memory");
-			} else {
-				memcpy(line, line_buffer,
-				       line_buffer_pos -
-					       2); // remove trailing newline
-				memset(line_buffer, 0, ARRAY_SIZE(line_buffer));
-				line[line_buffer_pos - 2] = 0;
-				line_buffer_pos = 0;
+	uint32_t numreceived =
+		ring_buf_get_claim(&grbl->rx_buf, &buffer, GRBL_RX_RING_SIZE);
 
-				k_fifo_put(&grbl_receive_fifo, line);
-			}
-		}
+	for (int i = 0; i < numreceived; i++) {
+		grbl_receive_char(grbl, buffer[i]);
 	}
 
-	ring_buf_get_finish(&grbl_rx_buf, numreceived);
+	ring_buf_get_finish(&grbl->rx_buf, numreceived);
 }
 
-void grbl_uart_callback(const struct device *dev, void *user_data)
+static void grbl_uart_callback(const struct device *dev, void *user_data)
 {
+	struct grbl_ctx *grbl = user_data;
+
 	while (uart_irq_update(dev) && uart_irq_is_pending(dev)) {
 		if (uart_irq_rx_ready(dev)) {
-			grbl_uart_irq_rx(dev);
+			grbl_uart_irq_rx(grbl);
 		}
 
 		if (uart_irq_tx_ready(dev)) {
-			grbl_uart_irq_tx(dev);
+			grbl_uart_irq_tx(grbl);
 		}
 	}
 }
 
-static enum grbl_message detect_response_type(const char *response)
+static void grbl_ack_line(struct grbl_ctx *grbl)
 {
-	uint32_t response_len = strlen(response);
+	k_mutex_lock(&grbl->cmd_mutex, K_FOREVER);
+
+	/* ignore responses to lines we didn't send, e.g. after a reset */
+	if (grbl->inflight_count > 0) {
+		grbl->inflight_bytes -= grbl->inflight_len[grbl->inflight_head];
+		grbl->inflight_head =
+			(grbl->inflight_head + 1) % GRBL_MAX_INFLIGHT;
+		grbl->inflight_count--;
+		grbl->ack_seq++;
+	}
+
+	if (grbl->homing && grbl->ack_seq == grbl->homing_seq) {
+		grbl->homing = false;
+		grbl->last_report_time = k_uptime_get_32();
+	}
 
-	for (int i = 0; i < ARRAY_SIZE(msg_prefix); i++) {
-		int prefix_len = strlen(msg_prefix[i]);
+	k_condvar_broadcast(&grbl->new_response_condvar);
+	k_mutex_unlock(&grbl->cmd_mutex);
+}
 
-		if (prefix_len > response_len) {
-			prefix_len = response_len;
-		}
+static void grbl_report_received(struct grbl_ctx *grbl, const char *msg)
+{
+	k_mutex_lock(&grbl->cmd_mutex, K_FOREVER);
+	grbl_parse_report(msg, &grbl->state);
+	grbl->report_seq++;
+	grbl->last_report_time = k_uptime_get_32();
+	k_condvar_broadcast(&grbl->new_response_condvar);
+	k_mutex_unlock(&grbl->cmd_mutex);
+}
+
+/*
+ * Something went wrong on the link. Waiting for the responses in flight
+ * would block forever, so fail them and let the owner of grbl recover.
+ */
+static void grbl_fault(struct grbl_ctx *grbl, enum grbl_fault fault)
+{
+	atomic_set(&grbl->fault, fault);
+	k_work_submit(&grbl->fault_work);
+}
+
+static void grbl_receive_worker(void *p1, void *p2, void *p3)
+{
+	struct grbl_ctx *grbl = p1;
+
+	while (true) {
+		struct grbl_line *line =
+			k_fifo_get(&grbl->receive_fifo, K_FOREVER);
+		const char *msg = line->text;
+		enum grbl_message resp_type = grbl_parse_response_type(msg);
+		switch (resp_type) {
+		case GRBL_OK:
+		case GRBL_ERROR:
+			grbl_ack_line(grbl);
+			break;
+		case GRBL_WELCOME:
+			k_mutex_lock(&grbl->cmd_mutex, K_FOREVER);
+			grbl->welcome_seq++;
+			if (!grbl->reset_pending) {
+				LOG_WRN("%s: grbl restarted", grbl->uart->name);
+				grbl_fault(grbl, GRBL_FAULT_RESTART);
+			}
+			grbl->reset_pending = false;
+			k_condvar_broadcast(&grbl->new_response_condvar);
+			k_mutex_unlock(&grbl->cmd_mutex);
+			break;
+		case GRBL_ALARM:
+			LOG_WRN("%s: %s", grbl->uart->name, msg);
+			grbl->alarm = grbl_parse_alarm(msg);
+			grbl_fault(grbl, GRBL_FAULT_ALARM);
+			break;
+		case GRBL_REPORT:
+			grbl_report_received(grbl, msg);
+			break;
+		case GRBL_SETTINGS:
+			grbl_parse_setting(msg, &grbl->settings);
+			break;
+		case GRBL_STARTUP_EXEC:
+			break;
+		case GRBL_FEEDBACK:
+			grbl_parse_work_offset(msg, grbl->work_offsets);
+			break;
+		case GRBL_INVALID:
+		default:
 
-		if (strncmp(response, msg_prefix[i], prefix_len) == 0) {
-			return (enum grbl_message)i;
+			break;
 		}
-	}
 
-	return GRBL_INVALID;
+		k_mem_slab_free(&grbl->line_slab, (void **)&line);
+	}
 }
 
-static enum GrblCtrlState parse_ctrl_state(const char *state)
+/*
+ * Queue a command without waiting for its acknowledgement. Lines are
+ * streamed with character counting, so this only blocks while the serial
+ * buffer of grbl is full. Every line terminator in msg is acknowledged by
+ * grbl separately. Returns the sequence number to wait for, 0 if the line
+ * was dropped because grbl got reset meanwhile.
+ */
+uint32_t grbl_queue_command(struct grbl_ctx *grbl, const char *msg)
 {
-	size_t response_len = strlen(state);
-	for (int i = 0; i < ARRAY_SIZE(state_str); i++) {
-		int prefix_len = strlen(msg_prefix[i]);
+	const char *line = msg;
+	const char *c;
+
+	if (grbl->power != GRBL_POWER_ON) {
+		grbl_wake(grbl);
+	}
+
+	LOG_INF("%s: %s", grbl->uart->name, msg);
+	k_mutex_lock(&grbl->cmd_mutex, K_FOREVER);
+
+	uint32_t flush_count = grbl->flush_count;
+
+	for (c = msg; *c != 0; c++) {
+		uint8_t len;
+		uint16_t used;
 
-		if (prefix_len > response_len) {
-			prefix_len = response_len;
+		if (*c != '\n' && *c != '\r') {
+			continue;
+		}
+
+		len = c - line + 1;
+
+		while (grbl->inflight_count >= GRBL_MAX_INFLIGHT ||
+		       grbl->inflight_bytes + len > GRBL_RX_BUFFER_SIZE) {
+			k_condvar_wait(&grbl->new_response_condvar,
+				       &grbl->cmd_mutex, K_FOREVER);
+
+			if (grbl->flush_count != flush_count) {
+				k_mutex_unlock(&grbl->cmd_mutex);
+				return 0;
+			}
 		}
 
-		if (strncmp(state, msg_prefix[i], prefix_len) == 0) {
-			return (enum GrblCtrlState)i;
+		grbl->inflight_len[(grbl->inflight_head +
+				    grbl->inflight_count) %
+				   GRBL_MAX_INFLIGHT] = len;
+		grbl->inflight_count++;
+		grbl->inflight_bytes += len;
+		grbl->tx_seq++;
+
+		if (strncmp(line, "$H", 2) == 0) {
+			grbl->homing = true;
+			grbl->homing_seq = grbl->tx_seq;
+			grbl->last_report_time = k_uptime_get_32();
 		}
+
+		k_spinlock_key_t key = k_spin_lock(&grbl->tx_lock);
+
+		ring_buf_put(&grbl->tx_buf, line, len);
+		used = GRBL_TX_RING_SIZE - ring_buf_space_get(&grbl->tx_buf);
+		k_spin_unlock(&grbl->tx_lock, key);
+		uart_irq_tx_enable(grbl->uart);
+		grbl->tx_peak = MAX(grbl->tx_peak, used);
+		line = c + 1;
 	}
 
-	return 0;
+	k_mutex_unlock(&grbl->cmd_mutex);
+	return grbl->tx_seq;
+}
+
+/*
+ * Wait until all lines up to seq are acknowledged. Returns -ECANCELED if
+ * the line got dropped by a reset or a link fault instead.
+ */
+int grbl_wait_ack(struct grbl_ctx *grbl, uint32_t seq)
+{
+	int rc = 0;
+
+	if (seq == 0) {
+		return -ECANCELED;
+	}
+
+	k_mutex_lock(&grbl->cmd_mutex, K_FOREVER);
+
+	while ((int32_t)(grbl->ack_seq - seq) < 0) {
+		k_condvar_wait(&grbl->new_response_condvar, &grbl->cmd_mutex,
+			       K_FOREVER);
+	}
+
+	if ((int32_t)(seq - grbl->flushed_from) > 0 &&
+	    (int32_t)(seq - grbl->flushed_to) <= 0) {
+		rc = -ECANCELED;
+	}
+
+	k_mutex_unlock(&grbl->cmd_mutex);
+	return rc;
 }
 
-const char *grbl_state_to_str(enum GrblCtrlState state)
+int grbl_send_command(struct grbl_ctx *grbl, const char *msg)
 {
-	return state_str[(int)state];
+	return grbl_wait_ack(grbl, grbl_queue_command(grbl, msg));
 }
 
-static void parse_work_offsets(const char *msg)
+/* Request a status report and wait until it arrived */
+int grbl_refresh_state(struct grbl_ctx *grbl, k_timeout_t timeout)
 {
-	char prefix[6] = { 0 };
-	for (int i = 0; i < 5; i++) {
-		snprintk(prefix, ARRAY_SIZE(prefix), "[G5%d:", i + 4);
+	int rc = 0;
 
-		if (strncmp(msg, prefix, 5) != 0) {
-			continue;
-		}
+	k_mutex_lock(&grbl->cmd_mutex, K_FOREVER);
+	uint32_t seq = grbl->report_seq;
+
+	grbl_send_byte_no_ack(grbl, '?');
 
-		parse_position(msg + 5, &workOffsets[i].offset.x,
-			       &workOffsets[i].offset.y,
-			       &workOffsets[i].offset.z);
+	while (grbl->report_seq == seq && rc == 0) {
+		rc = k_condvar_wait(&grbl->new_response_condvar,
+				    &grbl->cmd_mutex, timeout);
 	}
+
+	k_mutex_unlock(&grbl->cmd_mutex);
+	return rc;
 }
 
-static void parse_report(const char *msg)
+/* True once grbl acknowledged line seq, or the line got dropped */
+bool grbl_is_acked(struct grbl_ctx *grbl, uint32_t seq)
 {
-	char *seperator;
-	char *data_start = strchr(msg, '|');
+	k_mutex_lock(&grbl->cmd_mutex, K_FOREVER);
+	bool acked = (int32_t)(grbl->ack_seq - seq) >= 0;
 
-	if (data_start == NULL) {
-		return;
+	k_mutex_unlock(&grbl->cmd_mutex);
+	return acked;
+}
+
+uint32_t grbl_flush_count(struct grbl_ctx *grbl)
+{
+	return grbl->flush_count;
+}
+
+/* Forget about all lines in flight, their responses will never arrive */
+static void grbl_flush(struct grbl_ctx *grbl)
+{
+	k_mutex_lock(&grbl->cmd_mutex, K_FOREVER);
+	uart_irq_tx_disable(grbl->uart);
+	k_spinlock_key_t key = k_spin_lock(&grbl->tx_lock);
+
+	ring_buf_reset(&grbl->tx_buf);
+	k_spin_unlock(&grbl->tx_lock, key);
+	grbl->inflight_count = 0;
+	grbl->inflight_bytes = 0;
+	grbl->flushed_from = grbl->ack_seq;
+	grbl->flushed_to = grbl->tx_seq;
+	grbl->ack_seq = grbl->tx_seq;
+	grbl->homing = false;
+	grbl->flush_count++;
+	k_condvar_broadcast(&grbl->new_response_condvar);
+	k_mutex_unlock(&grbl->cmd_mutex);
+}
+
+/* Soft reset grbl and wait until it is back */
+int grbl_reset(struct grbl_ctx *grbl)
+{
+	int rc = 0;
+
+	grbl_flush(grbl);
+
+	k_mutex_lock(&grbl->cmd_mutex, K_FOREVER);
+	uint32_t seq = grbl->welcome_seq;
+
+	grbl->reset_pending = true;
+	grbl_send_byte_no_ack(grbl, 0x18);
+
+	while (grbl->welcome_seq == seq && rc == 0) {
+		rc = k_condvar_wait(&grbl->new_response_condvar,
+				    &grbl->cmd_mutex, K_SECONDS(1));
 	}
 
-	data_start++;
+	if (rc == 0) {
+		/* the link is alive, give the status reports time to resume */
+		grbl->last_report_time = k_uptime_get_32();
+	} else {
+		grbl->reset_pending = false;
+	}
 
-	currentState.state = parse_ctrl_state(msg + 1);
+	k_mutex_unlock(&grbl->cmd_mutex);
+	return rc;
+}
 
-	while (true) {
-		seperator = strchr(data_start, ':');
+/*
+ * Stop all motion including what is queued in the planner. A reset while
+ * moving would lose the position, so bring the machine to a feed hold
+ * first and reset once it stands still.
+ */
+int grbl_abort_motion(struct grbl_ctx *grbl)
+{
+	struct GrblState last = grbl_get_state(grbl);
 
-		if (seperator == NULL) {
-			return;
+	grbl_send_byte_no_ack(grbl, '!');
+
+	for (int i = 0; i < 50; i++) {
+		/* grbl doesn't respond, a reset is all that is left */
+		if (grbl_refresh_state(grbl, K_MSEC(500)) != 0) {
+			break;
 		}
 
-		if (strncmp(data_start, "MPos", 4) == 0) {
-			parse_position(seperator + 1, &currentState.pos_act.x,
-				       &currentState.pos_act.y,
-				       &currentState.pos_act.z);
+		struct GrblState state = grbl_get_state(grbl);
+
+		if (state.state != GRBL_STATE_RUN &&
+		    state.state != GRBL_STATE_JOG &&
+		    memcmp(&state.pos_act, &last.pos_act,
+			   sizeof(struct Position)) == 0) {
+			break;
 		}
 
-		data_start = strchr(seperator + 1, '|');
+		last = state;
+	}
 
-		if (data_start == NULL) {
-			return;
+	return grbl_reset(grbl);
+}
+
+/*
+ * Return the fault raised since the last call, if any. The fault signal
+ * is raised once the commands in flight have been failed.
+ */
+enum grbl_fault grbl_take_fault(struct grbl_ctx *grbl)
+{
+	return atomic_clear(&grbl->fault);
+}
+
+static void grbl_fault_work(struct k_work *work)
+{
+	struct grbl_ctx *grbl = CONTAINER_OF(work, struct grbl_ctx, fault_work);
+
+	grbl_flush(grbl);
+	k_poll_signal_raise(&grbl->fault_signal, atomic_get(&grbl->fault));
+}
+
+int grbl_get_work_offset(struct grbl_ctx *grbl, int num, struct Position *pos)
+{
+	if (num < 0 || num >= GRBL_WORK_OFFSETS) {
+		return -EINVAL;
+	}
+
+	*pos = grbl->work_offsets[num].offset;
+	return 0;
+}
+
+/*
+ * Read the machine settings of grbl. They are reported before the ok of
+ * $$, so the cache is complete once the command is acknowledged.
+ */
+int grbl_read_settings(struct grbl_ctx *grbl)
+{
+	int rc = grbl_send_command(grbl, "$$\n");
+
+	grbl->settings.valid = rc == 0 && grbl->settings.max_rate[0] > 0 &&
+			       grbl->settings.max_rate[1] > 0 &&
+			       grbl->settings.accel[0] > 0 &&
+			       grbl->settings.accel[1] > 0;
+	return grbl->settings.valid ? 0 : -EIO;
+}
+
+/*
+ * Limit pan and tilt of a machine position to the travel of grbl. After
+ * homing grbl places the machine space at [-max travel, 0]. Returns true
+ * if pos had to be changed.
+ */
+bool grbl_clamp_position(struct grbl_ctx *grbl, struct Position *pos)
+{
+	const struct GrblSettings *settings = &grbl->settings;
+	float *axis[] = { &pos->x, &pos->y };
+	bool clamped = false;
+
+	if (!settings->valid) {
+		return false;
+	}
+
+	for (int i = 0; i < ARRAY_SIZE(axis); i++) {
+		if (settings->max_travel[i] <= 0) {
+			continue;
+		}
+
+		if (*axis[i] > 0) {
+			*axis[i] = 0;
+			clamped = true;
+		} else if (*axis[i] < -settings->max_travel[i]) {
+			*axis[i] = -settings->max_travel[i];
+			clamped = true;
 		}
 	}
+
+	return clamped;
 }
 
-static void grbl_receive_worker()
+/*
+ * Estimate how long grbl needs for a straight move from rest to rest with
+ * a trapezoidal velocity profile. feed in units/min, 0 for a rapid move.
+ * Like grbl, the rate and acceleration along the move are limited so that
+ * no axis exceeds its own limit. Returns 0 without cached settings.
+ */
+uint32_t grbl_estimate_move_ms(struct grbl_ctx *grbl,
+			       const struct Position *from,
+			       const struct Position *to, float feed)
 {
-	while (true) {
-		char *msg = k_fifo_get(&grbl_receive_fifo, K_FOREVER);
-		enum grbl_message resp_type = detect_response_type(msg);
-		// LOG_INF("%s", msg);
-		switch (resp_type) {
-		case GRBL_OK:
-		case GRBL_ERROR:
-			k_mutex_lock(&grbl_cmd_mutex, K_FOREVER);
-			k_condvar_signal(&grbl_new_response_condvar);
-			k_mutex_unlock(&grbl_cmd_mutex);
-			break;
-		case GRBL_WELCOME:
-			break;
-		case GRBL_ALARM:
-			break;
-		case GRBL_REPORT:
-			parse_report(msg);
-			break;
-		case GRBL_SETTINGS:
-			break;
-		case GRBL_STARTUP_EXEC:
-			break;
-		case GRBL_FEEDBACK:
-			parse_work_offsets(msg);
-			break;
-		case GRBL_INVALID:
-		default:
+	const struct GrblSettings *settings = &grbl->settings;
+	float delta[] = { to->x - from->x, to->y - from->y };
+	float distance = sqrtf(delta[0] * delta[0] + delta[1] * delta[1]);
+	float rate = feed > 0 ? feed : INFINITY;
+	float accel = INFINITY;
+	float t;
+
+	if (!settings->valid || distance == 0) {
+		return 0;
+	}
 
-			break;
+	for (int i = 0; i < ARRAY_SIZE(delta); i++) {
+		float unit = fabsf(delta[i]) / distance;
+
+		if (unit > 0) {
+			rate = MIN(rate, settings->max_rate[i] / unit);
+			accel = MIN(accel, settings->accel[i] / unit);
 		}
+	}
+
+	rate /= 60;
 
-		k_free(msg);
+	if (distance > rate * rate / accel) {
+		/* accelerate, cruise, decelerate */
+		t = distance / rate + rate / accel;
+	} else {
+		/* triangular profile, never reaches the rate */
+		t = 2 * sqrtf(distance / accel);
 	}
+
+	return (uint32_t)ceilf(t * 1000);
 }
 
-int grbl_send_command(const char *msg)
+/* Also called from the report timer, so no mutex here */
+int grbl_send_byte_no_ack(struct grbl_ctx *grbl, uint8_t payload)
 {
-	LOG_INF("%s", msg);
-	k_mutex_lock(&grbl_cmd_mutex, K_FOREVER);
-	ring_buf_put(&grbl_tx_buf, msg, strlen(msg));
-	uart_irq_tx_enable(grbl_dev);
-	k_condvar_wait(&grbl_new_response_condvar, &grbl_cmd_mutex, K_FOREVER);
-	k_mutex_unlock(&grbl_cmd_mutex);
+	k_spinlock_key_t key = k_spin_lock(&grbl->tx_lock);
+
+	ring_buf_put(&grbl->tx_buf, &payload, 1);
+	k_spin_unlock(&grbl->tx_lock, key);
+	uart_irq_tx_enable(grbl->uart);
 	return 0;
 }
 
-int grbl_send_byte_no_ack(uint8_t payload)
+struct GrblState grbl_get_state(struct grbl_ctx *grbl)
 {
-	ring_buf_put(&grbl_tx_buf, &payload, 1);
-	uart_irq_tx_enable(grbl_dev);
-	return 0;
+	return grbl->state;
 }
 
-struct GrblState grbl_get_state()
+static void grbl_report_timer_expr(struct k_timer *timer)
 {
-	return currentState;
+	struct grbl_ctx *grbl =
+		CONTAINER_OF(timer, struct grbl_ctx, report_timer);
+
+	/*
+	 * The homing cycle of grbl doesn't run the realtime commands, a
+	 * sweep over the whole travel at the seek rate ($25) easily takes
+	 * longer than the link timeout. It gets its own bound instead.
+	 */
+	uint32_t timeout = grbl->homing ?
+				   CONFIG_CAMERAPANTILT_GRBL_HOMING_TIMEOUT_S *
+					   1000 :
+				   CONFIG_CAMERAPANTILT_GRBL_TIMEOUT_MS;
+
+	grbl_send_byte_no_ack(grbl, '?');
+
+	if (atomic_get(&grbl->fault) == GRBL_FAULT_NONE &&
+	    k_uptime_get_32() - grbl->last_report_time > timeout) {
+		LOG_WRN("%s: grbl stopped responding", grbl->uart->name);
+		grbl_fault(grbl, GRBL_FAULT_TIMEOUT);
+	}
 }
 
-static void grbl_report_timer_expr(struct k_timer *dummy)
+/* Takes effect once grbl is awake again if it is idle */
+void grbl_set_report_interval(struct grbl_ctx *grbl, k_timeout_t interval)
 {
-	grbl_send_byte_no_ack('?');
+	grbl->report_interval = interval;
+
+	if (grbl->power == GRBL_POWER_ON) {
+		k_timer_start(&grbl->report_timer, K_NO_WAIT, interval);
+	}
 }
 
-int grbl_initialize(const struct device *uart)
+/*
+ * Stop polling grbl while the head is idle, with deep set grbl goes to
+ * sleep as well. The next command wakes it up again.
+ */
+int grbl_sleep(struct grbl_ctx *grbl, bool deep)
 {
-	grbl_dev = uart;
+	int rc = 0;
 
-	uart_irq_callback_set(grbl_dev, grbl_uart_callback);
-	uart_irq_rx_enable(grbl_dev);
+	k_mutex_lock(&grbl->power_lock, K_FOREVER);
 
-	k_thread_create(&grbl_receive_thread_data, grbl_receive_stack,
-			K_THREAD_STACK_SIZEOF(grbl_receive_stack),
-			grbl_receive_worker, NULL, NULL, NULL, -1, 0,
+	if (grbl->power == GRBL_POWER_ON) {
+		k_timer_stop(&grbl->report_timer);
+
+		if (deep) {
+			rc = grbl_send_command(grbl, "$SLP\n");
+		}
+
+		grbl->power = deep && rc == 0 ? GRBL_POWER_SLEEP :
+						GRBL_POWER_QUIET;
+	}
+
+	k_mutex_unlock(&grbl->power_lock);
+	return rc;
+}
+
+/*
+ * Only a reset ends the sleep of grbl. It comes back locked in alarm but
+ * the position is still valid as it stood still, so unlocking is enough.
+ */
+int grbl_wake(struct grbl_ctx *grbl)
+{
+	int rc = 0;
+
+	k_mutex_lock(&grbl->power_lock, K_FOREVER);
+
+	if (grbl->power == GRBL_POWER_SLEEP) {
+		rc = grbl_reset(grbl);
+	}
+
+	if (rc == 0 && grbl->power != GRBL_POWER_ON) {
+		enum grbl_power power = grbl->power;
+
+		grbl->power = GRBL_POWER_ON;
+		grbl->last_report_time = k_uptime_get_32();
+		k_timer_start(&grbl->report_timer, K_NO_WAIT,
+			      grbl->report_interval);
+
+		if (power == GRBL_POWER_SLEEP) {
+			rc = grbl_send_command(grbl, "$X\n");
+		}
+	}
+
+	k_mutex_unlock(&grbl->power_lock);
+	return rc;
+}
+
+bool grbl_is_awake(struct grbl_ctx *grbl)
+{
+	return grbl->power == GRBL_POWER_ON;
+}
+
+int grbl_initialize(struct grbl_ctx *grbl, const struct device *uart)
+{
+	grbl->uart = uart;
+	grbl->line = NULL;
+	grbl->line_dropped = false;
+
+	ring_buf_init(&grbl->tx_buf, sizeof(grbl->tx_data), grbl->tx_data);
+	ring_buf_init(&grbl->rx_buf, sizeof(grbl->rx_data), grbl->rx_data);
+	k_mem_slab_init(&grbl->line_slab, grbl->lines, sizeof(struct grbl_line),
+			ARRAY_SIZE(grbl->lines));
+	k_fifo_init(&grbl->receive_fifo);
+	k_condvar_init(&grbl->new_response_condvar);
+	k_mutex_init(&grbl->cmd_mutex);
+	k_mutex_init(&grbl->power_lock);
+	k_timer_init(&grbl->report_timer, grbl_report_timer_expr, NULL);
+	k_work_init(&grbl->fault_work, grbl_fault_work);
+	k_poll_signal_init(&grbl->fault_signal);
+	grbl->last_report_time = k_uptime_get_32();
+	grbl->power = GRBL_POWER_ON;
+
+	uart_irq_callback_user_data_set(grbl->uart, grbl_uart_callback, grbl);
+	uart_irq_rx_enable(grbl->uart);
+
+	k_thread_create(&grbl->receive_thread, grbl->receive_stack,
+			K_KERNEL_STACK_SIZEOF(grbl->receive_stack),
+			grbl_receive_worker, grbl, NULL, NULL, -1, 0,
 			K_NO_WAIT);
+	k_thread_name_set(&grbl->receive_thread, uart->name);
 
-	k_timer_start(&report_timer, K_NO_WAIT, K_SECONDS(1));
+	grbl_set_report_interval(grbl, GRBL_REPORT_INTERVAL);
 	return 0;
 }
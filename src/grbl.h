@@ -2,7 +2,22 @@
 #define CAMPANTILT__GRBL__H
 
 #include <stdint.h>
+#include <zephyr.h>
 #include <device.h>
+#include <sys/ring_buffer.h>
+
+#define GRBL_TX_RING_SIZE CONFIG_CAMERAPANTILT_GRBL_TX_BUF_SIZE
+#define GRBL_RX_RING_SIZE CONFIG_CAMERAPANTILT_GRBL_RX_BUF_SIZE
+#define GRBL_LINE_SIZE 128
+#define GRBL_LINE_QUEUE_DEPTH CONFIG_CAMERAPANTILT_GRBL_LINE_QUEUE_DEPTH
+#define GRBL_RECEIVE_STACK_SIZE CONFIG_CAMERAPANTILT_GRBL_STACK_SIZE
+/* serial rx buffer of grbl, used for character counting */
+#define GRBL_RX_BUFFER_SIZE 128
+#define GRBL_MAX_INFLIGHT 16
+/* G54-G59, G28 and G30 */
+#define GRBL_WORK_OFFSETS 8
+#define GRBL_REPORT_INTERVAL K_SECONDS(1)
+#define GRBL_AXES 3
 
 struct Position {
 	float x, y, z;
@@ -17,7 +32,8 @@ enum GrblCtrlState {
 	GRBL_STATE_DOOR,
 	GRBL_STATE_CHECK,
 	GRBL_STATE_HOME,
-	GRBL_STATE_SLEEP
+	GRBL_STATE_SLEEP,
+	GRBL_STATE_UNKNOWN
 };
 
 struct GrblState {
@@ -25,9 +41,133 @@ struct GrblState {
 	struct Position pos_act;
 };
 
-int grbl_send_command(const char *msg);
-int grbl_send_byte_no_ack(uint8_t payload);
-int grbl_initialize(const struct device *uart);
-struct GrblState grbl_get_state();
+struct WorkOffset {
+	int wco_num;
+	struct Position offset;
+};
+
+/* Reasons for the link supervisor to step in */
+enum grbl_fault {
+	GRBL_FAULT_NONE,
+	/* grbl restarted on its own, e.g. after a brown out */
+	GRBL_FAULT_RESTART,
+	GRBL_FAULT_ALARM,
+	/* no status report for CONFIG_CAMERAPANTILT_GRBL_TIMEOUT_MS */
+	GRBL_FAULT_TIMEOUT
+};
+
+enum grbl_power {
+	GRBL_POWER_ON,
+	/* no status reports, nothing wakes the MCU */
+	GRBL_POWER_QUIET,
+	/* additionally grbl sleeps ($SLP), needs a reset to wake up */
+	GRBL_POWER_SLEEP
+};
+
+/* grbl stops a soft limit alarm with a feed hold, the position stays */
+#define GRBL_ALARM_SOFT_LIMIT 2
+
+/* Machine settings of grbl ($$) needed to plan moves locally */
+struct GrblSettings {
+	bool valid;
+	float max_rate[GRBL_AXES]; /* $110-$112, units/min */
+	float accel[GRBL_AXES]; /* $120-$122, units/s^2 */
+	float max_travel[GRBL_AXES]; /* $130-$132, units */
+};
+
+/* A line received from grbl, without the line terminator */
+struct grbl_line {
+	void *fifo_reserved;
+	char text[GRBL_LINE_SIZE];
+};
+
+/* One GRBL controller connected to a dedicated uart */
+struct grbl_ctx {
+	const struct device *uart;
+
+	/* commands, realtime bytes and the report timer all put into tx_buf */
+	struct k_spinlock tx_lock;
+	struct ring_buf tx_buf;
+	struct ring_buf rx_buf;
+	uint8_t tx_data[GRBL_TX_RING_SIZE];
+	uint8_t rx_data[GRBL_RX_RING_SIZE];
+
+	/* the receive interrupt fills the lines in place */
+	struct k_mem_slab line_slab;
+	struct grbl_line lines[GRBL_LINE_QUEUE_DEPTH];
+	struct grbl_line *line;
+	uint8_t line_pos;
+	bool line_dropped;
+
+	/* high water marks, see the head mem shell command */
+	uint16_t tx_peak;
+	uint8_t lines_peak;
+
+	struct k_fifo receive_fifo;
+	struct k_condvar new_response_condvar;
+	struct k_mutex cmd_mutex;
+
+	/* lines sent to grbl which are not acknowledged yet */
+	uint8_t inflight_len[GRBL_MAX_INFLIGHT];
+	uint8_t inflight_head;
+	uint8_t inflight_count;
+	uint16_t inflight_bytes;
+	uint32_t tx_seq;
+	uint32_t ack_seq;
+	uint32_t report_seq;
+	uint32_t welcome_seq;
+	uint32_t flush_count;
+	/* lines in (flushed_from, flushed_to] were dropped by the last flush */
+	uint32_t flushed_from;
+	uint32_t flushed_to;
+	bool reset_pending;
+
+	/* link supervision, see grbl_take_fault() */
+	atomic_t fault;
+	int alarm;
+	uint32_t last_report_time;
+	/* grbl doesn't answer status requests until $H is done */
+	bool homing;
+	uint32_t homing_seq;
+	struct k_work fault_work;
+	struct k_poll_signal fault_signal;
+
+	/* sends a regular status report realtime command to grbl */
+	struct k_timer report_timer;
+	k_timeout_t report_interval;
+
+	enum grbl_power power;
+	struct k_mutex power_lock;
+
+	struct k_thread receive_thread;
+	K_KERNEL_STACK_MEMBER(receive_stack, GRBL_RECEIVE_STACK_SIZE);
+
+	struct GrblState state;
+	struct WorkOffset work_offsets[GRBL_WORK_OFFSETS];
+	struct GrblSettings settings;
+};
+
+int grbl_send_command(struct grbl_ctx *grbl, const char *msg);
+uint32_t grbl_queue_command(struct grbl_ctx *grbl, const char *msg);
+int grbl_wait_ack(struct grbl_ctx *grbl, uint32_t seq);
+int grbl_refresh_state(struct grbl_ctx *grbl, k_timeout_t timeout);
+int grbl_get_work_offset(struct grbl_ctx *grbl, int num, struct Position *pos);
+int grbl_read_settings(struct grbl_ctx *grbl);
+bool grbl_clamp_position(struct grbl_ctx *grbl, struct Position *pos);
+uint32_t grbl_estimate_move_ms(struct grbl_ctx *grbl,
+			       const struct Position *from,
+			       const struct Position *to, float feed);
+bool grbl_is_acked(struct grbl_ctx *grbl, uint32_t seq);
+uint32_t grbl_flush_count(struct grbl_ctx *grbl);
+int grbl_reset(struct grbl_ctx *grbl);
+int grbl_abort_motion(struct grbl_ctx *grbl);
+enum grbl_fault grbl_take_fault(struct grbl_ctx *grbl);
+int grbl_sleep(struct grbl_ctx *grbl, bool deep);
+int grbl_wake(struct grbl_ctx *grbl);
+bool grbl_is_awake(struct grbl_ctx *grbl);
+void grbl_set_report_interval(struct grbl_ctx *grbl, k_timeout_t interval);
+int grbl_send_byte_no_ack(struct grbl_ctx *grbl, uint8_t payload);
+int grbl_initialize(struct grbl_ctx *grbl, const struct device *uart);
+struct GrblState grbl_get_state(struct grbl_ctx *grbl);
 
-#endif
\ No newline at end of file
+#endif
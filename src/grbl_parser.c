@@ -0,0 +1,201 @@
+/*
+ * camera pantilt controller
+ *
+ * Copyright (c) Thomas Schmid, 2021
+ *
+ * Authors:
+ *  Thomas Schmid <tom@lfence.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 3.  See
+ * the LICENSE file in the top-level directory.
+ */
+
+#include <zephyr.h>
+#include <string.h>
+#include <stdlib.h>
+#include "grbl_parser.h"
+
+static const char *const msg_prefix[] = {
+	[GRBL_OK] = "ok",	   [GRBL_REPORT] = "<",
+	[GRBL_ERROR] = "error:",   [GRBL_ALARM] = "ALARM:",
+	[GRBL_FEEDBACK] = "[",	   [GRBL_SETTINGS] = "$",
+	[GRBL_STARTUP_EXEC] = ">", [GRBL_WELCOME] = "Grbl"
+};
+
+static const char *const state_str[] = {
+	[GRBL_STATE_IDLE] = "Idle",   [GRBL_STATE_RUN] = "Run",
+	[GRBL_STATE_HOLD] = "Hold",   [GRBL_STATE_JOG] = "Jog",
+	[GRBL_STATE_ALARM] = "Alarm", [GRBL_STATE_DOOR] = "Door",
+	[GRBL_STATE_CHECK] = "Check", [GRBL_STATE_HOME] = "Home",
+	[GRBL_STATE_SLEEP] = "Sleep", [GRBL_STATE_UNKNOWN] = "?"
+};
+
+static const char *const offset_prefix[GRBL_WORK_OFFSETS] = {
+	"[G54:", "[G55:", "[G56:", "[G57:", "[G58:", "[G59:", "[G28:", "[G30:"
+};
+
+static bool has_prefix(const char *str, const char *prefix)
+{
+	return strncmp(str, prefix, strlen(prefix)) == 0;
+}
+
+/* x,y[,z], grbl builds with two axes don't report z */
+static int parse_position(const char *msg, struct Position *pos)
+{
+	float *axis[] = { &pos->x, &pos->y, &pos->z };
+	const char *start = msg;
+	char *end;
+
+	pos->z = 0;
+
+	for (int i = 0; i < ARRAY_SIZE(axis); i++) {
+		*axis[i] = strtof(start, &end);
+
+		if (end == start) {
+			return i < 2 ? -EINVAL : 0;
+		}
+
+		if (*end != ',') {
+			return i < 1 ? -EINVAL : 0;
+		}
+
+		start = end + 1;
+	}
+
+	return 0;
+}
+
+enum grbl_message grbl_parse_response_type(const char *response)
+{
+	for (int i = 0; i < ARRAY_SIZE(msg_prefix); i++) {
+		if (has_prefix(response, msg_prefix[i])) {
+			return (enum grbl_message)i;
+		}
+	}
+
+	return GRBL_INVALID;
+}
+
+/* Idle|..., Hold:0|... */
+enum GrblCtrlState grbl_parse_ctrl_state(const char *state)
+{
+	for (int i = 0; i < GRBL_STATE_UNKNOWN; i++) {
+		size_t len = strlen(state_str[i]);
+
+		if (strncmp(state, state_str[i], len) == 0 &&
+		    (state[len] == '|' || state[len] == ':' ||
+		     state[len] == '>' || state[len] == 0)) {
+			return (enum GrblCtrlState)i;
+		}
+	}
+
+	return GRBL_STATE_UNKNOWN;
+}
+
+const char *grbl_state_to_str(enum GrblCtrlState state)
+{
+	if (state > GRBL_STATE_UNKNOWN) {
+		state = GRBL_STATE_UNKNOWN;
+	}
+
+	return state_str[(int)state];
+}
+
+/*
+ * <Idle|MPos:0.000,0.000,0.000|FS:0,0>. Fields other than the state and
+ * the machine position are skipped, state is only updated as a whole.
+ */
+int grbl_parse_report(const char *msg, struct GrblState *state)
+{
+	struct GrblState parsed = *state;
+	const char *field = strchr(msg, '|');
+
+	if (msg[0] != '<' || field == NULL) {
+		return -EINVAL;
+	}
+
+	parsed.state = grbl_parse_ctrl_state(msg + 1);
+
+	while (field != NULL) {
+		field++;
+
+		if (has_prefix(field, "MPos:") &&
+		    parse_position(field + 5, &parsed.pos_act) != 0) {
+			return -EINVAL;
+		}
+
+		field = strchr(field, '|');
+	}
+
+	*state = parsed;
+	return 0;
+}
+
+/* ALARM:1 */
+int grbl_parse_alarm(const char *msg)
+{
+	if (!has_prefix(msg, msg_prefix[GRBL_ALARM])) {
+		return -EINVAL;
+	}
+
+	return atoi(msg + strlen(msg_prefix[GRBL_ALARM]));
+}
+
+/* $110=500.000, settings not needed for planning are ignored */
+int grbl_parse_setting(const char *msg, struct GrblSettings *settings)
+{
+	char *end;
+	long num;
+	int axis;
+
+	if (msg[0] != '$') {
+		return -EINVAL;
+	}
+
+	num = strtol(msg + 1, &end, 10);
+	axis = num % 10;
+
+	if (end == msg + 1 || *end != '=') {
+		return -EINVAL;
+	}
+
+	if (axis >= GRBL_AXES) {
+		return 0;
+	}
+
+	switch (num / 10) {
+	case 11:
+		settings->max_rate[axis] = strtof(end + 1, NULL);
+		break;
+	case 12:
+		settings->accel[axis] = strtof(end + 1, NULL);
+		break;
+	case 13:
+		settings->max_travel[axis] = strtof(end + 1, NULL);
+		break;
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+/* [G54:0.000,0.000,0.000], returns the index of the offset */
+int grbl_parse_work_offset(const char *msg, struct WorkOffset *offsets)
+{
+	for (int i = 0; i < GRBL_WORK_OFFSETS; i++) {
+		if (!has_prefix(msg, offset_prefix[i])) {
+			continue;
+		}
+
+		if (parse_position(msg + strlen(offset_prefix[i]),
+				   &offsets[i].offset) != 0) {
+			return -EINVAL;
+		}
+
+		offsets[i].wco_num = i;
+		return i;
+	}
+
+	return -EINVAL;
+}
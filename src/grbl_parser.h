@@ -0,0 +1,28 @@
+#ifndef CAMPANTILT__GRBL_PARSER__H
+#define CAMPANTILT__GRBL_PARSER__H
+
+#include "grbl.h"
+
+/* Pure parsers for the lines grbl sends, no state of their own */
+
+enum grbl_message {
+	GRBL_OK,
+	GRBL_REPORT,
+	GRBL_ERROR,
+	GRBL_ALARM,
+	GRBL_FEEDBACK,
+	GRBL_SETTINGS,
+	GRBL_STARTUP_EXEC,
+	GRBL_WELCOME,
+	GRBL_INVALID
+};
+
+enum grbl_message grbl_parse_response_type(const char *response);
+enum GrblCtrlState grbl_parse_ctrl_state(const char *state);
+const char *grbl_state_to_str(enum GrblCtrlState state);
+int grbl_parse_report(const char *msg, struct GrblState *state);
+int grbl_parse_alarm(const char *msg);
+int grbl_parse_setting(const char *msg, struct GrblSettings *settings);
+int grbl_parse_work_offset(const char *msg, struct WorkOffset *offsets);
+
+#endif
@@ -0,0 +1,918 @@
+/*
+ * camera pantilt controller
+ *
+ * Copyright (c) Thomas Schmid, 2021
+ *
+ * Authors:
+ *  Thomas Schmid <tom@lfence.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 3.  See
+ * the LICENSE file in the top-level directory.
+ */
+
+#define DT_DRV_COMPAT camerapantilt_grbl_head
+
+#include <zephyr.h>
+#include <string.h>
+#include <logging/log.h>
+#include <drivers/uart.h>
+#include <shell/shell.h>
+#include <stdlib.h>
+#include "head.h"
+#include "grbl.h"
+#include "settings.h"
+#include "visca_port.h"
+#include "motion.h"
+#include "record.h"
+#include "tracking.h"
+#include "axis.h"
+
+LOG_MODULE_REGISTER(head, CONFIG_LOG_DEFAULT_LEVEL);
+
+#define HEAD_DISPATCH_STACK_SIZE CONFIG_CAMERAPANTILT_HEAD_DISPATCH_STACK_SIZE
+#define HEAD_JOG_STACK_SIZE CONFIG_CAMERAPANTILT_HEAD_JOG_STACK_SIZE
+/* each jog increment covers this much time at the current speed */
+#define HEAD_JOG_PERIOD_MS 100
+#define HEAD_TILT_SPEED_LEVELS 0x14
+
+/* A pan tilt head: one grbl controller plus the threads driving it */
+struct head {
+	const struct device *uart;
+	uint8_t visca_addr;
+
+	struct axis pan, tilt;
+	struct grbl_ctx grbl;
+	struct k_fifo cmd_fifo;
+
+	bool jog_active;
+	uint8_t pan_speed, tilt_speed;
+	int8_t pan_dir, tilt_dir;
+	char cmd_buffer[128];
+	struct SettingData current_setting;
+	struct SettingData presets[SETTING_SLOTS];
+	uint32_t preset_duration_ms;
+	bool preset_eased;
+	struct tour tour;
+	struct k_work_delayable completion_work;
+	/* raised when a frame for this head starts while it is idle */
+	struct k_poll_signal wake_signal;
+	struct k_sem jog_sem;
+
+	struct k_thread dispatch_thread;
+	struct k_thread jog_thread;
+	K_KERNEL_STACK_MEMBER(dispatch_stack, HEAD_DISPATCH_STACK_SIZE);
+	K_KERNEL_STACK_MEMBER(jog_stack, HEAD_JOG_STACK_SIZE);
+};
+
+#define HEAD_INIT(n)                                                           \
+	{                                                                      \
+		.uart = DEVICE_DT_GET(DT_INST_PHANDLE(n, uart)),               \
+		.visca_addr = DT_INST_PROP(n, visca_address),                  \
+		.pan = AXIS_DT_INST(n, pan, AXIS_SPEED_LEVELS),                \
+		.tilt = AXIS_DT_INST(n, tilt, HEAD_TILT_SPEED_LEVELS),         \
+	},
+
+static struct head heads[] = { DT_INST_FOREACH_STATUS_OKAY(HEAD_INIT) };
+
+/*
+ * Queued commands live in a slab. Decoders write straight into a block,
+ * which is passed on to the dispatcher and freed once it is handled.
+ */
+struct head_queued_command {
+	void *fifo_reserved;
+	struct visca_command cmd;
+};
+
+K_MEM_SLAB_DEFINE(head_command_slab, sizeof(struct head_queued_command),
+		  CONFIG_CAMERAPANTILT_COMMAND_QUEUE_DEPTH, 4);
+static uint32_t head_command_peak;
+
+static const struct SettingData defaultSetting = { .pos = { .x = 0,
+							     .y = 0,
+							     .z = 0 } };
+
+static void head_jog_worker(void *p1, void *p2, void *p3)
+{
+	struct head *head = p1;
+	bool last_jog = false;
+
+	while (true) {
+		if (last_jog != head->jog_active) {
+			if (!head->jog_active) {
+				grbl_send_byte_no_ack(&head->grbl, 0x85);
+			}
+			last_jog = head->jog_active;
+		}
+
+		if (head->jog_active) {
+			char jogcmd[64];
+			struct Position step = { 0 };
+			int32_t pan = axis_feed(&head->pan, head->pan_speed) *
+				      head->pan_dir;
+			int32_t tilt = axis_feed(&head->tilt, head->tilt_speed) *
+				       head->tilt_dir;
+			uint32_t feed = axis_isqrt((int64_t)pan * pan +
+						   (int64_t)tilt * tilt);
+
+			axis_put(&head->pan, &step,
+				 pan * HEAD_JOG_PERIOD_MS / 60000);
+			axis_put(&head->tilt, &step,
+				 tilt * HEAD_JOG_PERIOD_MS / 60000);
+
+			snprintk(jogcmd, ARRAY_SIZE(jogcmd),
+				 "$J=G91 X%.3f Y%.3f F%.3f\n", step.x, step.y,
+				 feed / 1000.0f);
+			grbl_send_command(&head->grbl, jogcmd);
+		} else {
+			k_sem_take(&head->jog_sem, K_FOREVER);
+		}
+	}
+}
+
+static void head_reply_position(struct head *head)
+{
+	struct GrblState state = grbl_get_state(&head->grbl);
+	uint8_t frame[11] = { (head->visca_addr + 8) << 4, 0x50 };
+	int32_t pan =
+		axis_to_visca(&head->pan, axis_get(&head->pan, &state.pos_act));
+	int32_t tilt = axis_to_visca(&head->tilt,
+				     axis_get(&head->tilt, &state.pos_act));
+
+	visca_encode_nibbles(pan, &frame[2]);
+	visca_encode_nibbles(tilt, &frame[6]);
+	frame[10] = VISCA_TERMINATOR;
+
+	visca_port_send(frame, sizeof(frame));
+}
+
+static void head_reply(struct head *head, uint8_t type)
+{
+	uint8_t frame[] = { (head->visca_addr + 8) << 4, type | 1,
+			    VISCA_TERMINATOR };
+
+	visca_port_send(frame, sizeof(frame));
+}
+
+static void head_reply_error(struct head *head, uint8_t error)
+{
+	uint8_t frame[] = { (head->visca_addr + 8) << 4, VISCA_REPLY_ERROR | 1,
+			    error, VISCA_TERMINATOR };
+
+	visca_port_send(frame, sizeof(frame));
+}
+
+static void head_completion_work(struct k_work *work)
+{
+	struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+	struct head *head =
+		CONTAINER_OF(dwork, struct head, completion_work);
+
+	head_reply(head, VISCA_REPLY_COMPLETION);
+}
+
+static void head_camera_zoom_get(struct SettingData *setting)
+{
+	static const uint8_t zoom_inq[] = { 0x09, 0x04, 0x47 };
+	uint8_t reply[VISCA_FRAME_MAX];
+	int rc = visca_port_camera_request(zoom_inq, sizeof(zoom_inq), reply,
+					   sizeof(reply));
+
+	/* y0 50 0p 0q 0r 0s FF */
+	setting->has_zoom = rc == 7;
+
+	if (setting->has_zoom) {
+		setting->zoom = visca_decode_nibbles(&reply[2]);
+	} else {
+		LOG_ERR("unable to read camera zoom position. rc: %d", rc);
+	}
+}
+
+static void head_camera_zoom_set(const struct SettingData *setting)
+{
+	uint8_t zoom_direct[7] = { 0x01, 0x04, 0x47 };
+
+	if (!setting->has_zoom) {
+		return;
+	}
+
+	visca_encode_nibbles(setting->zoom, &zoom_direct[3]);
+	visca_port_camera_request(zoom_direct, sizeof(zoom_direct), NULL, 0);
+}
+
+static void head_stop_jog(struct head *head)
+{
+	if (head->jog_active) {
+		head->jog_active = false;
+		k_sleep(K_MSEC(100)); // wait some time to make sure jog is aborted
+	}
+}
+
+/*
+ * Absolute and relative moves in machine coordinates, the same ones the
+ * position inquiry reports. Targets outside the travel of grbl are
+ * clamped or rejected here instead of running into a soft limit alarm.
+ * The completion is sent once the move is expected to be finished.
+ */
+/*
+ * Machine position of a VISCA pan and tilt position, limited to the range
+ * of both axes. Other axes stay at pos. Returns true if it was clamped.
+ */
+static bool head_visca_to_machine(struct head *head, int32_t pan,
+				  int32_t tilt, struct Position *pos)
+{
+	bool clamped = axis_clamp(&head->pan, &pan);
+
+	clamped |= axis_clamp(&head->tilt, &tilt);
+	axis_put(&head->pan, pos, axis_to_machine(&head->pan, pan));
+	axis_put(&head->tilt, pos, axis_to_machine(&head->tilt, tilt));
+	return clamped;
+}
+
+static void head_move(struct head *head, const struct visca_command *cmd)
+{
+	const struct visca_ptd_abs_rel_motion *motion =
+		&cmd->payload.ptd_abs_motion;
+	struct grbl_ctx *grbl = &head->grbl;
+	struct Position start = grbl_get_state(grbl).pos_act;
+	struct Position target = start;
+	int32_t pan = (int16_t)motion->pan_pos;
+	int32_t tilt = (int16_t)motion->tilt_pos;
+	int32_t feed;
+	bool clamped;
+
+	head_stop_jog(head);
+
+	if (cmd->cmd == PTD_REL) {
+		pan += axis_to_visca(&head->pan, axis_get(&head->pan, &start));
+		tilt += axis_to_visca(&head->tilt,
+				      axis_get(&head->tilt, &start));
+	}
+
+	clamped = head_visca_to_machine(head, pan, tilt, &target);
+	clamped |= grbl_clamp_position(grbl, &target);
+
+	if (clamped) {
+		if (IS_ENABLED(CONFIG_CAMERAPANTILT_REJECT_OUT_OF_TRAVEL)) {
+			head_reply_error(head, VISCA_ERROR_NOT_EXECUTABLE);
+			return;
+		}
+
+		LOG_WRN("head %d: target out of travel, clamped to %.3f %.3f",
+			head->visca_addr, target.x, target.y);
+	}
+
+	feed = axis_path_feed(
+		&head->pan, motion->pan_speed,
+		axis_get(&head->pan, &target) - axis_get(&head->pan, &start),
+		&head->tilt, motion->titlt_speed,
+		axis_get(&head->tilt, &target) - axis_get(&head->tilt, &start));
+
+	head_reply(head, VISCA_REPLY_ACK);
+
+	snprintk(head->cmd_buffer, ARRAY_SIZE(head->cmd_buffer),
+		 "G90 G53 G1 X%.3f Y%.3f F%.3f\n", target.x, target.y,
+		 feed / 1000.0f);
+	grbl_send_command(grbl, head->cmd_buffer);
+
+	k_work_reschedule(&head->completion_work,
+			  K_MSEC(grbl_estimate_move_ms(grbl, &start, &target,
+						       feed / 1000.0f)));
+}
+
+static void head_handle_command(struct head *head, struct visca_command *cmd)
+{
+	struct grbl_ctx *grbl = &head->grbl;
+
+	record_command(grbl, cmd);
+
+	/* the operator takes over from a running tour or tracker */
+	if (cmd->cmd != PTD_POS_INQ) {
+		tracking_stop(grbl);
+	}
+
+	if (cmd->cmd != PTD_POS_INQ && cmd->cmd != CAM_MEMORY_SET &&
+	    cmd->cmd != PTD_TOUR) {
+		tour_stop(&head->tour);
+	}
+
+	if (cmd->cmd == PTD_TOUR) {
+		if (cmd->payload.ptd_tour.start) {
+			tour_start(&head->tour);
+		} else {
+			tour_stop(&head->tour);
+		}
+		return;
+	}
+
+	if (cmd->cmd == PTD_ABS || cmd->cmd == PTD_REL) {
+		head_move(head, cmd);
+		return;
+	}
+
+	/* Check if jog command */
+	if (cmd->cmd == PTD_DOWN || cmd->cmd == PTD_DOWNLEFT ||
+	    cmd->cmd == PTD_DOWNRIGHT || cmd->cmd == PTD_UP ||
+	    cmd->cmd == PTD_UPLEFT || cmd->cmd == PTD_UPRIGHT ||
+	    cmd->cmd == PTD_LEFT || cmd->cmd == PTD_RIGHT ||
+	    cmd->cmd == PTD_STOP) {
+		head->pan_speed = cmd->payload.ptd_jog_motion.pan_speed;
+		head->tilt_speed = cmd->payload.ptd_jog_motion.titlt_speed;
+
+		if (cmd->cmd != PTD_STOP) {
+			head->jog_active = true;
+			k_sem_give(&head->jog_sem);
+		} else {
+			head->jog_active = false;
+			grbl_send_byte_no_ack(grbl, 0x85);
+		}
+
+		switch (cmd->cmd) {
+		case PTD_UP:
+			head->pan_dir = 0;
+			head->tilt_dir = 1;
+			break;
+		case PTD_DOWN:
+			head->pan_dir = 0;
+			head->tilt_dir = -1;
+			break;
+		case PTD_LEFT:
+			head->pan_dir = -1;
+			head->tilt_dir = 0;
+			break;
+		case PTD_RIGHT:
+			head->pan_dir = 1;
+			head->tilt_dir = 0;
+			break;
+		case PTD_UPLEFT:
+			head->pan_dir = -1;
+			head->tilt_dir = 1;
+			break;
+		case PTD_UPRIGHT:
+			head->pan_dir = 1;
+			head->tilt_dir = 1;
+			break;
+		case PTD_DOWNLEFT:
+			head->pan_dir = -1;
+			head->tilt_dir = -1;
+			break;
+		case PTD_DOWNRIGHT:
+			head->pan_dir = 1;
+			head->tilt_dir = -1;
+			break;
+		default:
+			head->pan_dir = 0;
+			head->tilt_dir = 0;
+			break;
+		}
+	}
+
+	if (cmd->cmd == PTD_HOME) {
+		grbl_send_command(grbl, "$H\n");
+		return;
+	}
+
+	if (cmd->cmd == PTD_RESET) {
+		grbl_send_command(grbl, "$X\n");
+		return;
+	}
+
+	if (cmd->cmd == PTD_POS_INQ) {
+		head_reply_position(head);
+		return;
+	}
+
+	if (cmd->cmd == CAM_MEMORY_RECALL) {
+		uint8_t slot = cmd->payload.cam_memory.memory_slot;
+
+		LOG_INF("memory recall");
+
+		/* start zooming first so both moves run in parallel */
+		if (IS_ENABLED(CONFIG_CAMERAPANTILT_VISCA_PROXY) &&
+		    slot < ARRAY_SIZE(head->presets)) {
+			head_camera_zoom_set(&head->presets[slot]);
+		}
+
+		head_stop_jog(head);
+
+		if (setting_get(grbl, slot, &head->current_setting) == 0) {
+			motion_move_timed(grbl, &head->current_setting.pos,
+					  head->preset_duration_ms,
+					  head->preset_eased);
+		}
+		return;
+	}
+
+	if (cmd->cmd == PTD_ABS_TIMED) {
+		struct Position target = grbl_get_state(grbl).pos_act;
+
+		head_visca_to_machine(head, cmd->payload.ptd_timed_motion.pan_pos,
+				      cmd->payload.ptd_timed_motion.tilt_pos,
+				      &target);
+		head_stop_jog(head);
+		motion_move_timed(grbl, &target,
+				  cmd->payload.ptd_timed_motion.duration_ms,
+				  cmd->payload.ptd_timed_motion.eased);
+		return;
+	}
+
+	if (cmd->cmd == CAM_MEMORY_SET) {
+		uint8_t slot = cmd->payload.cam_memory.memory_slot;
+
+		LOG_INF("memory set");
+		head->current_setting.pos = grbl_get_state(grbl).pos_act;
+		setting_set(grbl, slot, &head->current_setting);
+
+		if (IS_ENABLED(CONFIG_CAMERAPANTILT_VISCA_PROXY)) {
+			head_camera_zoom_get(&head->current_setting);
+		}
+
+		if (slot < ARRAY_SIZE(head->presets)) {
+			head->presets[slot] = head->current_setting;
+		}
+
+		/* survives a reboot like the work offset of the slot */
+		if (IS_ENABLED(CONFIG_CAMERAPANTILT_VISCA_PROXY) &&
+		    slot < ARRAY_SIZE(head->presets)) {
+			setting_zoom_store(head - heads, slot,
+					   &head->presets[slot]);
+		}
+	}
+}
+
+/*
+ * Home or unlock grbl and restore what a reset of grbl loses: the modal
+ * state and the cached machine settings and work offsets.
+ */
+static int head_bring_up(struct head *head, bool home)
+{
+	struct grbl_ctx *grbl = &head->grbl;
+	int rc;
+
+	LOG_INF("head %d: %s", head->visca_addr,
+		home ? "start homing" : "unlock");
+	rc = grbl_send_command(grbl, home ? "$H\n" : "$X\n");
+	if (rc != 0) {
+		return rc;
+	}
+
+	grbl_send_command(grbl, "$10=1\n");
+
+	if (grbl_read_settings(grbl) != 0) {
+		LOG_WRN("head %d: no machine settings, travel is not checked",
+			head->visca_addr);
+	}
+
+	rc = grbl_send_command(grbl, "$#\n");
+	if (rc != 0) {
+		return rc;
+	}
+
+	return grbl_send_command(grbl, "G90 G54\n");
+}
+
+/*
+ * Bring a head back after grbl restarted, raised an alarm or stopped
+ * responding. The grbl driver already failed all commands in flight.
+ */
+static int head_recover(struct head *head)
+{
+	struct grbl_ctx *grbl = &head->grbl;
+	enum grbl_fault fault = grbl_take_fault(grbl);
+	bool home = IS_ENABLED(CONFIG_CAMERAPANTILT_RECOVERY_HOME);
+	int rc;
+
+	if (fault == GRBL_FAULT_NONE) {
+		return 0;
+	}
+
+	LOG_WRN("head %d: recovering from fault %d", head->visca_addr, fault);
+
+	head->jog_active = false;
+	k_work_cancel_delayable(&head->completion_work);
+	tracking_stop(grbl);
+	tour_stop(&head->tour);
+
+	/*
+	 * Always reset, even if grbl would accept commands. The lines still
+	 * in its rx buffer would be answered with error:9 otherwise, and
+	 * those answers acked the lines restoring the state below.
+	 */
+	rc = grbl_reset(grbl);
+	if (rc != 0) {
+		return rc;
+	}
+
+	/* soft limits stop with a feed hold, the position stays valid */
+	if (fault == GRBL_FAULT_ALARM && grbl->alarm == GRBL_ALARM_SOFT_LIMIT) {
+		home = false;
+	}
+
+	rc = head_bring_up(head, home);
+	if (rc == 0) {
+		LOG_INF("head %d: recovered", head->visca_addr);
+	}
+
+	return rc;
+}
+
+/*
+ * Nothing happened for a while. Stop polling grbl so the MCU can stay in
+ * idle and optionally put grbl to sleep. Only done while standing still,
+ * grbl refuses to sleep during motion anyway.
+ */
+static void head_idle(struct head *head)
+{
+	struct grbl_ctx *grbl = &head->grbl;
+
+	if (head->jog_active || atomic_get(&head->tour.active) ||
+	    tracking_is_active(grbl) || record_is_active(grbl)) {
+		return;
+	}
+
+	if (grbl_refresh_state(grbl, K_MSEC(500)) != 0 ||
+	    grbl_get_state(grbl).state != GRBL_STATE_IDLE) {
+		return;
+	}
+
+	LOG_INF("head %d: idle", head->visca_addr);
+	grbl_sleep(grbl, IS_ENABLED(CONFIG_CAMERAPANTILT_IDLE_GRBL_SLEEP));
+}
+
+static void head_dispatch_worker(void *p1, void *p2, void *p3)
+{
+	struct head *head = p1;
+	struct grbl_ctx *grbl = &head->grbl;
+	struct k_poll_event events[] = {
+		K_POLL_EVENT_INITIALIZER(K_POLL_TYPE_FIFO_DATA_AVAILABLE,
+					 K_POLL_MODE_NOTIFY_ONLY,
+					 &head->cmd_fifo),
+		K_POLL_EVENT_INITIALIZER(K_POLL_TYPE_SIGNAL,
+					 K_POLL_MODE_NOTIFY_ONLY,
+					 &grbl->fault_signal),
+		K_POLL_EVENT_INITIALIZER(K_POLL_TYPE_SIGNAL,
+					 K_POLL_MODE_NOTIFY_ONLY,
+					 &head->wake_signal),
+	};
+
+	grbl_send_command(grbl, "\r\n\r\n"); /* Wake up grbl */
+
+	if (head_bring_up(head, true) == 0) {
+		grbl_send_command(grbl, "G0 X0 Y0\n");
+		LOG_INF("head %d: ready", head->visca_addr);
+	}
+
+	while (true) {
+		struct head_queued_command *queued;
+		k_timeout_t timeout = K_FOREVER;
+
+		if (CONFIG_CAMERAPANTILT_IDLE_TIMEOUT_S > 0 &&
+		    grbl_is_awake(grbl)) {
+			timeout = K_SECONDS(CONFIG_CAMERAPANTILT_IDLE_TIMEOUT_S);
+		}
+
+		if (k_poll(events, ARRAY_SIZE(events), timeout) == -EAGAIN) {
+			head_idle(head);
+			continue;
+		}
+
+		if (events[2].state == K_POLL_STATE_SIGNALED) {
+			events[2].state = K_POLL_STATE_NOT_READY;
+			k_poll_signal_reset(&head->wake_signal);
+			grbl_wake(grbl);
+		}
+
+		if (events[1].state == K_POLL_STATE_SIGNALED) {
+			events[1].state = K_POLL_STATE_NOT_READY;
+			k_poll_signal_reset(&grbl->fault_signal);
+
+			while (head_recover(head) != 0) {
+				/* try again if grbl faults while recovering */
+				k_sleep(K_SECONDS(1));
+			}
+		}
+
+		events[0].state = K_POLL_STATE_NOT_READY;
+		queued = k_fifo_get(&head->cmd_fifo, K_NO_WAIT);
+
+		if (queued == NULL) {
+			continue;
+		}
+
+		head_handle_command(head, &queued->cmd);
+		head_command_free(&queued->cmd);
+	}
+}
+
+static int head_start(struct head *head)
+{
+	char name[16];
+	const struct uart_config grbl_uart_config = {
+		.baudrate = 115200,
+		.data_bits = UART_CFG_DATA_BITS_8,
+		.flow_ctrl = UART_CFG_FLOW_CTRL_NONE,
+		.parity = UART_CFG_PARITY_NONE,
+		.stop_bits = UART_CFG_STOP_BITS_1
+	};
+
+	if (!device_is_ready(head->uart)) {
+		LOG_ERR("head %d: grbl serial port not ready", head->visca_addr);
+		return -ENODEV;
+	}
+
+	if (uart_configure(head->uart, &grbl_uart_config) != 0) {
+		LOG_ERR("head %d: unable to configure uart for grbl",
+			head->visca_addr);
+		return -EIO;
+	}
+
+	memcpy(&head->current_setting, &defaultSetting,
+	       sizeof(struct SettingData));
+	head->preset_duration_ms = CONFIG_CAMERAPANTILT_PRESET_DURATION_MS;
+	head->preset_eased = IS_ENABLED(CONFIG_CAMERAPANTILT_PRESET_EASING);
+
+	for (int i = 0; i < ARRAY_SIZE(head->presets); i++) {
+		setting_zoom_load(head - heads, i, &head->presets[i]);
+	}
+	k_fifo_init(&head->cmd_fifo);
+	k_work_init_delayable(&head->completion_work, head_completion_work);
+	k_poll_signal_init(&head->wake_signal);
+	k_sem_init(&head->jog_sem, 0, 1);
+
+	grbl_initialize(&head->grbl, head->uart);
+	tour_init(&head->tour, &head->grbl);
+
+	k_thread_create(&head->jog_thread, head->jog_stack,
+			K_KERNEL_STACK_SIZEOF(head->jog_stack),
+			head_jog_worker, head, NULL, NULL, -1, 0, K_NO_WAIT);
+	snprintk(name, sizeof(name), "head%d jog", head->visca_addr);
+	k_thread_name_set(&head->jog_thread, name);
+	k_thread_create(&head->dispatch_thread, head->dispatch_stack,
+			K_KERNEL_STACK_SIZEOF(head->dispatch_stack),
+			head_dispatch_worker, head, NULL, NULL, 0, 0,
+			K_NO_WAIT);
+	snprintk(name, sizeof(name), "head%d dispatch", head->visca_addr);
+	k_thread_name_set(&head->dispatch_thread, name);
+	return 0;
+}
+
+int head_init(void)
+{
+	int rc = 0;
+
+	for (int i = 0; i < ARRAY_SIZE(heads); i++) {
+		int err = head_start(&heads[i]);
+
+		if (err != 0) {
+			rc = err;
+		}
+	}
+
+	return rc;
+}
+
+/* See head_visca_to_machine(), -ENODEV if the head is not ours */
+int head_to_machine(uint8_t visca_addr, int32_t pan, int32_t tilt,
+		    struct Position *pos)
+{
+	for (int i = 0; i < ARRAY_SIZE(heads); i++) {
+		if (heads[i].visca_addr == visca_addr) {
+			head_visca_to_machine(&heads[i], pan, tilt, pos);
+			return 0;
+		}
+	}
+
+	return -ENODEV;
+}
+
+bool head_is_local(uint8_t visca_addr)
+{
+	for (int i = 0; i < ARRAY_SIZE(heads); i++) {
+		if (heads[i].visca_addr == visca_addr) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+struct grbl_ctx *head_get_grbl(uint8_t visca_addr)
+{
+	for (int i = 0; i < ARRAY_SIZE(heads); i++) {
+		if (heads[i].visca_addr == visca_addr) {
+			return &heads[i].grbl;
+		}
+	}
+
+	return NULL;
+}
+
+struct tour *head_get_tour(uint8_t visca_addr)
+{
+	for (int i = 0; i < ARRAY_SIZE(heads); i++) {
+		if (heads[i].visca_addr == visca_addr) {
+			return &heads[i].tour;
+		}
+	}
+
+	return NULL;
+}
+
+/* Number the heads consecutively, returns the first address not taken */
+uint8_t head_assign_addresses(uint8_t first)
+{
+	uint8_t addr = first;
+
+	for (int i = 0; i < ARRAY_SIZE(heads); i++) {
+		if (addr >= VISCA_ADDR_BROADCAST) {
+			LOG_ERR("no visca address left for head %d", i);
+			heads[i].visca_addr = 0;
+			continue;
+		}
+
+		heads[i].visca_addr = addr++;
+	}
+
+	return addr;
+}
+
+/* May be called from an ISR, returns NULL if the queue is full */
+struct visca_command *head_command_alloc(void)
+{
+	struct head_queued_command *queued;
+
+	if (k_mem_slab_alloc(&head_command_slab, (void **)&queued,
+			     K_NO_WAIT) != 0) {
+		LOG_ERR("command queue full. Dropping command");
+		return NULL;
+	}
+
+	head_command_peak = MAX(head_command_peak,
+				k_mem_slab_num_used_get(&head_command_slab));
+
+	return &queued->cmd;
+}
+
+void head_command_free(struct visca_command *cmd)
+{
+	struct head_queued_command *queued =
+		CONTAINER_OF(cmd, struct head_queued_command, cmd);
+
+	k_mem_slab_free(&head_command_slab, (void **)&queued);
+}
+
+static void head_command_put(struct head *head, struct visca_command *cmd)
+{
+	k_fifo_put(&head->cmd_fifo,
+		   CONTAINER_OF(cmd, struct head_queued_command, cmd));
+}
+
+/*
+ * Hand a command from head_command_alloc() over to the head, it is freed
+ * in any case. Broadcasts are copied for all heads but the first one.
+ */
+int head_command_submit(uint8_t visca_addr, struct visca_command *cmd)
+{
+	struct head *targets[ARRAY_SIZE(heads)];
+	size_t count = 0;
+	int rc = 0;
+
+	for (int i = 0; i < ARRAY_SIZE(heads); i++) {
+		if (visca_addr == VISCA_ADDR_BROADCAST ||
+		    visca_addr == heads[i].visca_addr) {
+			targets[count++] = &heads[i];
+		}
+	}
+
+	if (count == 0) {
+		head_command_free(cmd);
+		return -ENODEV;
+	}
+
+	/* the original may be handled as soon as it is queued, copy first */
+	for (int i = 1; i < count; i++) {
+		struct visca_command *copy = head_command_alloc();
+
+		if (copy == NULL) {
+			rc = -ENOMEM;
+			continue;
+		}
+
+		memcpy(copy, cmd, sizeof(*copy));
+		head_command_put(targets[i], copy);
+	}
+
+	head_command_put(targets[0], cmd);
+	return rc;
+}
+
+/* Queue a copy of cmd */
+int head_submit(uint8_t visca_addr, const struct visca_command *cmd)
+{
+	struct visca_command *copy = head_command_alloc();
+
+	if (copy == NULL) {
+		return -ENOMEM;
+	}
+
+	memcpy(copy, cmd, sizeof(*copy));
+	return head_command_submit(visca_addr, copy);
+}
+
+/* May be called from an ISR, the dispatcher does the actual wake up */
+void head_wake(uint8_t visca_addr)
+{
+	for (int i = 0; i < ARRAY_SIZE(heads); i++) {
+		if ((visca_addr == VISCA_ADDR_BROADCAST ||
+		     visca_addr == heads[i].visca_addr) &&
+		    !grbl_is_awake(&heads[i].grbl)) {
+			k_poll_signal_raise(&heads[i].wake_signal, 0);
+		}
+	}
+}
+
+static struct head *head_get(const struct shell *sh, const char *addr)
+{
+	uint8_t visca_addr = strtoul(addr, NULL, 0);
+
+	for (int i = 0; i < ARRAY_SIZE(heads); i++) {
+		if (heads[i].visca_addr == visca_addr) {
+			return &heads[i];
+		}
+	}
+
+	shell_error(sh, "no head with address %d", visca_addr);
+	return NULL;
+}
+
+static int cmd_head_move(const struct shell *sh, size_t argc, char **argv)
+{
+	struct visca_command cmd = { .cmd = PTD_ABS_TIMED };
+	struct head *head = head_get(sh, argv[1]);
+
+	if (head == NULL) {
+		return -EINVAL;
+	}
+
+	cmd.payload.ptd_timed_motion.pan_pos = strtol(argv[2], NULL, 0);
+	cmd.payload.ptd_timed_motion.tilt_pos = strtol(argv[3], NULL, 0);
+	cmd.payload.ptd_timed_motion.duration_ms = strtoul(argv[4], NULL, 0);
+	cmd.payload.ptd_timed_motion.eased =
+		argc > 5 && strcmp(argv[5], "ease") == 0;
+
+	return head_submit(head->visca_addr, &cmd);
+}
+
+static int cmd_head_preset_time(const struct shell *sh, size_t argc,
+				char **argv)
+{
+	struct head *head = head_get(sh, argv[1]);
+
+	if (head == NULL) {
+		return -EINVAL;
+	}
+
+	if (argc > 2) {
+		head->preset_duration_ms = strtoul(argv[2], NULL, 0);
+		head->preset_eased = argc > 3 && strcmp(argv[3], "ease") == 0;
+	}
+
+	shell_print(sh, "preset recall: %d ms%s", head->preset_duration_ms,
+		    head->preset_eased ? ", eased" : "");
+	return 0;
+}
+
+/* Occupancy of the queues and buffers, the stacks are in "kernel stacks" */
+static int cmd_head_mem(const struct shell *sh, size_t argc, char **argv)
+{
+	shell_print(sh, "commands: %d of %d queued, peak %d",
+		    k_mem_slab_num_used_get(&head_command_slab),
+		    CONFIG_CAMERAPANTILT_COMMAND_QUEUE_DEPTH, head_command_peak);
+
+	for (int i = 0; i < ARRAY_SIZE(heads); i++) {
+		struct grbl_ctx *grbl = &heads[i].grbl;
+
+		shell_print(sh,
+			    "head %d: grbl tx peak %d of %d bytes, "
+			    "lines peak %d of %d",
+			    heads[i].visca_addr, grbl->tx_peak,
+			    GRBL_TX_RING_SIZE, grbl->lines_peak,
+			    GRBL_LINE_QUEUE_DEPTH);
+	}
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	head_cmds,
+	SHELL_CMD_ARG(move, NULL,
+		      "Timed move to VISCA pan and tilt positions\n"
+		      "usage: move <addr> <pan> <tilt> <ms> [ease]",
+		      cmd_head_move, 5, 1),
+	SHELL_CMD_ARG(preset_time, NULL,
+		      "Show or set duration of preset recalls\n"
+		      "usage: preset_time <addr> [<ms> [ease]]",
+		      cmd_head_preset_time, 2, 2),
+	SHELL_CMD(mem, NULL, "Queue and buffer usage", cmd_head_mem),
+	SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(head, &head_cmds, "Pan tilt heads", NULL);
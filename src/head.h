@@ -0,0 +1,25 @@
+#ifndef CAMPANTILT__HEAD__H
+#define CAMPANTILT__HEAD__H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "visca.h"
+#include "grbl.h"
+#include "tour.h"
+
+#define VISCA_ADDR_BROADCAST 8
+
+int head_init(void);
+bool head_is_local(uint8_t visca_addr);
+uint8_t head_assign_addresses(uint8_t first);
+int head_submit(uint8_t visca_addr, const struct visca_command *cmd);
+struct visca_command *head_command_alloc(void);
+void head_command_free(struct visca_command *cmd);
+int head_command_submit(uint8_t visca_addr, struct visca_command *cmd);
+void head_wake(uint8_t visca_addr);
+struct grbl_ctx *head_get_grbl(uint8_t visca_addr);
+struct tour *head_get_tour(uint8_t visca_addr);
+int head_to_machine(uint8_t visca_addr, int32_t pan, int32_t tilt,
+		    struct Position *pos);
+
+#endif
@@ -0,0 +1,170 @@
+/*
+ * camera pantilt controller
+ *
+ * Copyright (c) Thomas Schmid, 2021
+ *
+ * Authors:
+ *  Thomas Schmid <tom@lfence.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 3.  See
+ * the LICENSE file in the top-level directory.
+ */
+
+/*
+ * Timed moves. Pan and tilt are moved as one linear G1 move in machine
+ * coordinates whose feed rate is derived from the distance and the
+ * requested duration, so both axes start and arrive together. Eased moves
+ * are split into segments of equal duration following an S-curve.
+ */
+
+#include <zephyr.h>
+#include <math.h>
+#include <logging/log.h>
+#include "motion.h"
+
+LOG_MODULE_REGISTER(motion, CONFIG_LOG_DEFAULT_LEVEL);
+
+/* grbl can't move slower than this (mm/min) */
+#define MOTION_MIN_FEED 0.1f
+/* peak over average velocity of the smootherstep profile */
+#define MOTION_EASE_PEAK 1.875f
+
+/* fraction of the distance covered after each segment */
+static float ease_profile[MOTION_SEGMENTS + 1];
+
+void motion_init(void)
+{
+	for (int i = 0; i <= MOTION_SEGMENTS; i++) {
+		float t = (float)i / MOTION_SEGMENTS;
+
+		/* smootherstep, zero velocity and acceleration at both ends */
+		ease_profile[i] = t * t * t * (t * (t * 6 - 15) + 10);
+	}
+}
+
+static float motion_distance(const struct Position *a,
+			     const struct Position *b)
+{
+	float dx = b->x - a->x;
+	float dy = b->y - a->y;
+
+	return sqrtf(dx * dx + dy * dy);
+}
+
+static uint32_t motion_queue_segment(struct grbl_ctx *grbl,
+				     const struct Position *from,
+				     const struct Position *to,
+				     uint32_t duration_ms)
+{
+	char cmd[64];
+	float feed = motion_distance(from, to) * 60000.0f / duration_ms;
+
+	if (feed < MOTION_MIN_FEED) {
+		feed = MOTION_MIN_FEED;
+	}
+
+	snprintk(cmd, ARRAY_SIZE(cmd), "G53 G1 X%.3f Y%.3f F%.2f\n", to->x,
+		 to->y, feed);
+	return grbl_queue_command(grbl, cmd);
+}
+
+/*
+ * Queue a move from start to target (machine coordinates) taking
+ * duration_ms behind whatever is already queued. start has to be where
+ * the previous motion ends. Returns the sequence number of the last
+ * segment, 0 if grbl got reset while queueing.
+ */
+uint32_t motion_queue_move(struct grbl_ctx *grbl, const struct Position *start,
+			   const struct Position *target, uint32_t duration_ms,
+			   bool eased)
+{
+	uint32_t flush_count = grbl_flush_count(grbl);
+	struct Position from = *start;
+	uint32_t seq = 0;
+
+	if (!eased || duration_ms < MOTION_SEGMENTS) {
+		return motion_queue_segment(grbl, start, target, duration_ms);
+	}
+
+	for (int i = 1; i <= MOTION_SEGMENTS; i++) {
+		struct Position to = {
+			.x = start->x + (target->x - start->x) * ease_profile[i],
+			.y = start->y + (target->y - start->y) * ease_profile[i],
+			.z = start->z,
+		};
+
+		if (grbl_flush_count(grbl) != flush_count) {
+			return 0;
+		}
+
+		seq = motion_queue_segment(grbl, &from, &to,
+					   duration_ms / MOTION_SEGMENTS);
+		if (seq == 0) {
+			return 0;
+		}
+		from = to;
+	}
+
+	return seq;
+}
+
+/*
+ * Clamp end to the travel and stretch duration_ms to what the axes can do,
+ * otherwise grbl would cap the feed and both axes would arrive late.
+ */
+uint32_t motion_limit_move(struct grbl_ctx *grbl, const struct Position *start,
+			   struct Position *end, uint32_t duration_ms,
+			   bool eased)
+{
+	uint32_t min_ms;
+
+	if (grbl_clamp_position(grbl, end)) {
+		LOG_WRN("target out of travel, clamped to %.3f %.3f", end->x,
+			end->y);
+	}
+
+	min_ms = grbl_estimate_move_ms(grbl, start, end, 0);
+	if (eased) {
+		min_ms *= MOTION_EASE_PEAK;
+	}
+
+	if (duration_ms < min_ms) {
+		LOG_WRN("move needs at least %u ms", min_ms);
+		duration_ms = min_ms;
+	}
+
+	return duration_ms;
+}
+
+/*
+ * Move to target (machine coordinates) within duration_ms. Waits for
+ * previous motion to finish so the start position is exact, the segments
+ * themselves are only queued into the planner of grbl. Returns the
+ * duration of the move, which may be stretched, or a negative error.
+ */
+int motion_move_timed(struct grbl_ctx *grbl, const struct Position *target,
+		      uint32_t duration_ms, bool eased)
+{
+	struct Position start;
+	struct Position end = *target;
+	int rc;
+
+	if (duration_ms == 0) {
+		return -EINVAL;
+	}
+
+	grbl_send_command(grbl, "G4 P0\n");
+
+	rc = grbl_refresh_state(grbl, K_MSEC(500));
+	if (rc != 0) {
+		LOG_ERR("no status report from grbl. rc: %d", rc);
+		return rc;
+	}
+
+	start = grbl_get_state(grbl).pos_act;
+	duration_ms = motion_limit_move(grbl, &start, &end, duration_ms, eased);
+
+	rc = grbl_wait_ack(grbl, motion_queue_move(grbl, &start, &end,
+						   duration_ms, eased));
+	return rc < 0 ? rc : duration_ms;
+}
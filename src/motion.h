@@ -0,0 +1,21 @@
+#ifndef CAMPANTILT__MOTION__H
+#define CAMPANTILT__MOTION__H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "grbl.h"
+
+/* number of G1 segments an eased move is split into */
+#define MOTION_SEGMENTS 12
+
+void motion_init(void);
+uint32_t motion_queue_move(struct grbl_ctx *grbl, const struct Position *start,
+			   const struct Position *target, uint32_t duration_ms,
+			   bool eased);
+uint32_t motion_limit_move(struct grbl_ctx *grbl, const struct Position *start,
+			   struct Position *end, uint32_t duration_ms,
+			   bool eased);
+int motion_move_timed(struct grbl_ctx *grbl, const struct Position *target,
+		      uint32_t duration_ms, bool eased);
+
+#endif
@@ -0,0 +1,183 @@
+/*
+ * camera pantilt controller
+ *
+ * Copyright (c) Thomas Schmid, 2021
+ *
+ * Authors:
+ *  Thomas Schmid <tom@lfence.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 3.  See
+ * the LICENSE file in the top-level directory.
+ */
+
+/*
+ * Pelco-D and Pelco-P decoder. Frames are translated into the same
+ * commands the VISCA decoder produces, so the heads don't care which
+ * protocol the controller speaks.
+ *
+ * Pelco-D: FF addr cmd1 cmd2 data1 data2 sum, sum of bytes 1 to 5
+ * Pelco-P: A0 addr data1 data2 data3 data4 AF xor, xor of bytes 0 to 6
+ */
+
+#include <zephyr.h>
+#include <string.h>
+#include "pelco.h"
+
+/* bits of the second command byte */
+#define PELCO_RIGHT 0x02
+#define PELCO_LEFT 0x04
+#define PELCO_UP 0x08
+#define PELCO_DOWN 0x10
+
+/* extended commands have the lowest bit of the second byte set */
+#define PELCO_EXTENDED 0x01
+#define PELCO_PRESET_SET 0x03
+#define PELCO_PRESET_RECALL 0x07
+
+#define PELCO_SPEED_MAX 0x3F
+#define PELCO_VISCA_PAN_SPEED_MAX 0x18
+#define PELCO_VISCA_TILT_SPEED_MAX 0x14
+
+static uint8_t pelco_frame_size(const struct pelco_decoder *dec)
+{
+	return dec->variant == PELCO_D ? PELCO_D_FRAME_SIZE :
+					 PELCO_P_FRAME_SIZE;
+}
+
+static uint8_t pelco_sync(const struct pelco_decoder *dec)
+{
+	return dec->variant == PELCO_D ? PELCO_D_SYNC : PELCO_P_SYNC;
+}
+
+static bool pelco_frame_valid(const struct pelco_decoder *dec)
+{
+	const uint8_t *frame = dec->frame;
+	uint8_t check = 0;
+
+	if (dec->variant == PELCO_D) {
+		for (int i = 1; i < PELCO_D_FRAME_SIZE - 1; i++) {
+			check += frame[i];
+		}
+
+		return check == frame[PELCO_D_FRAME_SIZE - 1];
+	}
+
+	for (int i = 0; i < PELCO_P_FRAME_SIZE - 1; i++) {
+		check ^= frame[i];
+	}
+
+	return frame[PELCO_P_FRAME_SIZE - 2] == PELCO_P_END &&
+	       check == frame[PELCO_P_FRAME_SIZE - 1];
+}
+
+void pelco_decoder_init(struct pelco_decoder *dec, enum pelco_variant variant)
+{
+	dec->variant = variant;
+	dec->pos = 0;
+}
+
+/* Returns true once data completed a frame with a valid checksum */
+bool pelco_decoder_feed(struct pelco_decoder *dec, uint8_t data)
+{
+	uint8_t size = pelco_frame_size(dec);
+	uint8_t sync = pelco_sync(dec);
+
+	if (dec->pos == 0 && data != sync) {
+		return false;
+	}
+
+	dec->frame[dec->pos++] = data;
+
+	if (dec->pos < size) {
+		return false;
+	}
+
+	if (pelco_frame_valid(dec)) {
+		dec->pos = 0;
+		return true;
+	}
+
+	/* the sync byte was data, restart on the next one inside the frame */
+	uint8_t *next = memchr(&dec->frame[1], sync, size - 1);
+
+	dec->pos = 0;
+
+	if (next != NULL) {
+		dec->pos = &dec->frame[size] - next;
+		memmove(dec->frame, next, dec->pos);
+	}
+
+	return false;
+}
+
+/*
+ * Address of the frame being received or just completed. Pelco-P counts
+ * from 0, both are returned counting from 1 like the VISCA addresses.
+ */
+bool pelco_decoder_addr(const struct pelco_decoder *dec, uint8_t *addr)
+{
+	if (dec->pos == 1) {
+		return false;
+	}
+
+	*addr = dec->variant == PELCO_D ? dec->frame[1] : dec->frame[1] + 1;
+	return true;
+}
+
+static uint8_t pelco_speed(uint8_t speed, uint8_t visca_max)
+{
+	if (speed >= PELCO_SPEED_MAX) {
+		return visca_max;
+	}
+
+	return 1 + speed * (visca_max - 1) / PELCO_SPEED_MAX;
+}
+
+int pelco_frame_to_command(const struct pelco_decoder *dec,
+			   struct visca_command *cmd)
+{
+	const uint8_t *frame = dec->frame;
+	uint8_t cmd1 = frame[2];
+	uint8_t cmd2 = frame[3];
+	uint8_t pan = cmd2 & (PELCO_LEFT | PELCO_RIGHT);
+	uint8_t tilt = cmd2 & (PELCO_UP | PELCO_DOWN);
+
+	if (cmd2 & PELCO_EXTENDED) {
+		if (cmd1 != 0 || frame[5] == 0) {
+			return -1;
+		}
+
+		if (cmd2 == PELCO_PRESET_SET) {
+			cmd->cmd = CAM_MEMORY_SET;
+		} else if (cmd2 == PELCO_PRESET_RECALL) {
+			cmd->cmd = CAM_MEMORY_RECALL;
+		} else {
+			return -1;
+		}
+
+		/* presets count from 1 */
+		cmd->payload.cam_memory.memory_slot = frame[5] - 1;
+		return 0;
+	}
+
+	/* zoom, focus and iris bits are ignored, the head only moves */
+	if (pan == (PELCO_LEFT | PELCO_RIGHT) ||
+	    tilt == (PELCO_UP | PELCO_DOWN)) {
+		return -1;
+	}
+
+	static const enum visca_commands jog[3][3] = {
+		/* no tilt, up, down */
+		{ PTD_STOP, PTD_UP, PTD_DOWN },
+		{ PTD_LEFT, PTD_UPLEFT, PTD_DOWNLEFT },
+		{ PTD_RIGHT, PTD_UPRIGHT, PTD_DOWNRIGHT },
+	};
+
+	cmd->cmd = jog[pan == PELCO_LEFT ? 1 : pan == PELCO_RIGHT ? 2 : 0]
+		      [tilt == PELCO_UP ? 1 : tilt == PELCO_DOWN ? 2 : 0];
+	cmd->payload.ptd_jog_motion.pan_speed =
+		pelco_speed(frame[4], PELCO_VISCA_PAN_SPEED_MAX);
+	cmd->payload.ptd_jog_motion.titlt_speed =
+		pelco_speed(frame[5], PELCO_VISCA_TILT_SPEED_MAX);
+	return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef CAMPANTILT__PELCO__H
+#define CAMPANTILT__PELCO__H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "visca.h"
+
+#define PELCO_D_SYNC 0xFF
+#define PELCO_P_SYNC 0xA0
+#define PELCO_P_END 0xAF
+#define PELCO_D_FRAME_SIZE 7
+#define PELCO_P_FRAME_SIZE 8
+
+enum pelco_variant {
+	PELCO_D,
+	PELCO_P,
+};
+
+/* Collects the bytes of one frame, resyncs on the next sync byte */
+struct pelco_decoder {
+	enum pelco_variant variant;
+	uint8_t pos;
+	uint8_t frame[PELCO_P_FRAME_SIZE];
+};
+
+void pelco_decoder_init(struct pelco_decoder *dec, enum pelco_variant variant);
+bool pelco_decoder_feed(struct pelco_decoder *dec, uint8_t data);
+bool pelco_decoder_addr(const struct pelco_decoder *dec, uint8_t *addr);
+int pelco_frame_to_command(const struct pelco_decoder *dec,
+			   struct visca_command *cmd);
+
+#endif
@@ -0,0 +1,677 @@
+/*
+ * camera pantilt controller
+ *
+ * Copyright (c) Thomas Schmid, 2021
+ *
+ * Authors:
+ *  Thomas Schmid <tom@lfence.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 3.  See
+ * the LICENSE file in the top-level directory.
+ */
+
+/*
+ * Motion recording and playback on the storage partition of the nor flash.
+ *
+ * While recording the position of the head is sampled at a fixed period
+ * and stored delta encoded together with the visca commands received in
+ * between. The log starts at RECORD_PAGE_SIZE, the first page holds the
+ * header which is written when the recording is stopped. Entries never
+ * cross a page, unused space at the end of a page stays erased (0xFF).
+ *
+ * Playback reads the log in RECORD_CHUNK_SIZE chunks into two buffers, the
+ * next chunk is read while the current one is turned into G1 segments of
+ * one sample period each and streamed to grbl.
+ */
+
+#include <zephyr.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <logging/log.h>
+#include <shell/shell.h>
+#include <sys/byteorder.h>
+#include <storage/flash_map.h>
+#include "record.h"
+#include "motion.h"
+#include "head.h"
+
+LOG_MODULE_REGISTER(record, CONFIG_LOG_DEFAULT_LEVEL);
+
+#define RECORD_MAGIC 0x31525450 /* PTR1 */
+#define RECORD_PAGE_SIZE 256
+#define RECORD_SECTOR_SIZE 4096
+#define RECORD_CHUNK_SIZE CONFIG_CAMERAPANTILT_RECORD_CHUNK_SIZE
+#define RECORD_PERIOD_MS CONFIG_CAMERAPANTILT_RECORD_PERIOD_MS
+/* a keyframe limits the damage of a corrupted delta */
+#define RECORD_KEYFRAME_INTERVAL 256
+#define RECORD_ENTRY_MAX (1 + sizeof(struct visca_command))
+#define RECORD_STACK_SIZE CONFIG_CAMERAPANTILT_RECORD_STACK_SIZE
+
+BUILD_ASSERT(RECORD_CHUNK_SIZE % RECORD_PAGE_SIZE == 0,
+	     "playback chunks have to hold whole pages");
+
+enum record_tag {
+	REC_KEYFRAME = 0x01,
+	REC_DELTA = 0x02,
+	REC_IDLE = 0x03,
+	REC_COMMAND = 0x04,
+	REC_ERASED = 0xFF,
+};
+
+enum record_mode {
+	RECORD_OFF,
+	RECORD_RECORDING,
+	RECORD_PLAYING,
+};
+
+struct record_header {
+	uint32_t magic;
+	uint32_t length;
+	uint32_t samples;
+	uint16_t period_ms;
+	uint16_t reserved;
+} __packed;
+
+enum record_io_op {
+	IO_WRITE,
+	IO_READ,
+};
+
+struct record_io_req {
+	enum record_io_op op;
+	uint8_t buf;
+	off_t offset;
+	size_t len;
+};
+
+K_MSGQ_DEFINE(record_io_msgq, sizeof(struct record_io_req), 4, 4);
+K_MUTEX_DEFINE(record_lock);
+K_SEM_DEFINE(record_page_free, 2, 2);
+K_SEM_DEFINE(record_chunk_full_0, 0, 1);
+K_SEM_DEFINE(record_chunk_full_1, 0, 1);
+K_SEM_DEFINE(record_play_sem, 0, 1);
+
+static struct k_sem *const record_chunk_full[2] = { &record_chunk_full_0,
+						    &record_chunk_full_1 };
+
+static void record_sample_timer_expr(struct k_timer *timer);
+static void record_sample_work_handler(struct k_work *work);
+static void record_stop_work_handler(struct k_work *work);
+K_TIMER_DEFINE(record_sample_timer, record_sample_timer_expr, NULL);
+K_WORK_DEFINE(record_sample_work, record_sample_work_handler);
+K_WORK_DEFINE(record_stop_work, record_stop_work_handler);
+
+static const struct flash_area *record_fa;
+/* the partition rounded down to whole sectors, the io thread erases those */
+static size_t record_size;
+static volatile enum record_mode record_mode;
+static struct grbl_ctx *record_grbl;
+
+/* recording state */
+static uint8_t record_page[2][RECORD_PAGE_SIZE];
+static uint8_t record_page_idx;
+static size_t record_page_pos;
+static off_t record_offset;
+static int32_t record_last_x, record_last_y;
+static uint32_t record_samples;
+static uint32_t record_idle;
+static bool record_full;
+
+/* playback state */
+static uint8_t record_chunk[2][RECORD_CHUNK_SIZE];
+static struct record_header play_header;
+
+/* zigzag varint, small deltas of either sign take a single byte */
+static uint8_t *record_put_varint(uint8_t *p, int32_t value)
+{
+	uint32_t zigzag = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+
+	while (zigzag >= 0x80) {
+		*p++ = (zigzag & 0x7F) | 0x80;
+		zigzag >>= 7;
+	}
+	*p++ = zigzag;
+
+	return p;
+}
+
+static const uint8_t *record_get_varint(const uint8_t *p, int32_t *value)
+{
+	uint32_t zigzag = 0;
+	int shift = 0;
+
+	do {
+		zigzag |= (uint32_t)(*p & 0x7F) << shift;
+		shift += 7;
+	} while ((*p++ & 0x80) && shift < 35);
+
+	*value = (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+	return p;
+}
+
+static void record_flush_page(void)
+{
+	struct record_io_req req = {
+		.op = IO_WRITE,
+		.buf = record_page_idx,
+		.offset = record_offset,
+		.len = record_page_pos,
+	};
+
+	if (record_page_pos == 0) {
+		return;
+	}
+
+	k_sem_take(&record_page_free, K_FOREVER);
+	k_msgq_put(&record_io_msgq, &req, K_FOREVER);
+
+	record_offset += RECORD_PAGE_SIZE;
+	record_page_idx ^= 1;
+	record_page_pos = 0;
+}
+
+static void record_put_entry(const uint8_t *entry, size_t len)
+{
+	if (record_page_pos + len > RECORD_PAGE_SIZE) {
+		record_flush_page();
+	}
+
+	if (record_full) {
+		return;
+	}
+
+	if (record_offset + RECORD_PAGE_SIZE > record_size) {
+		LOG_ERR("storage full, recording truncated");
+		record_full = true;
+		/* the caller holds record_lock, finish like a regular stop */
+		k_work_submit(&record_stop_work);
+		return;
+	}
+
+	memcpy(&record_page[record_page_idx][record_page_pos], entry, len);
+	record_page_pos += len;
+}
+
+static void record_put_idle(void)
+{
+	uint8_t entry[RECORD_ENTRY_MAX] = { REC_IDLE };
+	uint8_t *end = record_put_varint(&entry[1], record_idle);
+
+	if (record_idle > 0) {
+		record_put_entry(entry, end - entry);
+		record_idle = 0;
+	}
+}
+
+static void record_put_sample(int32_t x, int32_t y)
+{
+	uint8_t entry[RECORD_ENTRY_MAX];
+	uint8_t *end;
+
+	if (record_samples % RECORD_KEYFRAME_INTERVAL == 0) {
+		record_put_idle();
+		entry[0] = REC_KEYFRAME;
+		sys_put_le32(x, &entry[1]);
+		sys_put_le32(y, &entry[5]);
+		record_put_entry(entry, 9);
+	} else if (x == record_last_x && y == record_last_y) {
+		record_idle++;
+	} else {
+		record_put_idle();
+		entry[0] = REC_DELTA;
+		end = record_put_varint(&entry[1], x - record_last_x);
+		end = record_put_varint(end, y - record_last_y);
+		record_put_entry(entry, end - entry);
+	}
+
+	record_last_x = x;
+	record_last_y = y;
+	record_samples++;
+}
+
+static void record_sample_work_handler(struct k_work *work)
+{
+	struct Position pos;
+
+	k_mutex_lock(&record_lock, K_FOREVER);
+
+	if (record_mode == RECORD_RECORDING) {
+		pos = grbl_get_state(record_grbl).pos_act;
+		record_put_sample(lroundf(pos.x * 1000), lroundf(pos.y * 1000));
+	}
+
+	k_mutex_unlock(&record_lock);
+}
+
+static void record_sample_timer_expr(struct k_timer *timer)
+{
+	k_work_submit(&record_sample_work);
+}
+
+static void record_stop_work_handler(struct k_work *work)
+{
+	record_stop();
+}
+
+/*
+ * Stop playback and drop what is queued in grbl already. Called with
+ * record_lock held, which keeps record_play_queue() from aborting again.
+ */
+static void record_play_abort(void)
+{
+	record_mode = RECORD_OFF;
+	grbl_abort_motion(record_grbl);
+}
+
+bool record_is_active(struct grbl_ctx *grbl)
+{
+	return record_mode != RECORD_OFF && record_grbl == grbl;
+}
+
+void record_command(struct grbl_ctx *grbl, const struct visca_command *cmd)
+{
+	uint8_t entry[RECORD_ENTRY_MAX] = { REC_COMMAND };
+
+	if (grbl != record_grbl) {
+		return;
+	}
+
+	k_mutex_lock(&record_lock, K_FOREVER);
+
+	/* anything the operator does takes over from playback */
+	if (record_mode == RECORD_PLAYING) {
+		LOG_INF("playback interrupted");
+		record_play_abort();
+	} else if (record_mode == RECORD_RECORDING) {
+		record_put_idle();
+		memcpy(&entry[1], cmd, sizeof(*cmd));
+		record_put_entry(entry, sizeof(entry));
+	}
+
+	k_mutex_unlock(&record_lock);
+}
+
+int record_start(struct grbl_ctx *grbl)
+{
+	int rc;
+
+	k_mutex_lock(&record_lock, K_FOREVER);
+
+	if (record_mode != RECORD_OFF) {
+		k_mutex_unlock(&record_lock);
+		return -EBUSY;
+	}
+
+	/* the first sector holds the header and the start of the log */
+	rc = flash_area_erase(record_fa, 0, RECORD_SECTOR_SIZE);
+	if (rc != 0) {
+		k_mutex_unlock(&record_lock);
+		return rc;
+	}
+
+	record_grbl = grbl;
+	record_offset = RECORD_PAGE_SIZE;
+	record_page_pos = 0;
+	record_samples = 0;
+	record_idle = 0;
+	record_full = false;
+	record_mode = RECORD_RECORDING;
+
+	struct Position pos = grbl_get_state(grbl).pos_act;
+
+	record_put_sample(lroundf(pos.x * 1000), lroundf(pos.y * 1000));
+	k_mutex_unlock(&record_lock);
+
+	grbl_set_report_interval(grbl, K_MSEC(RECORD_PERIOD_MS));
+	k_timer_start(&record_sample_timer, K_MSEC(RECORD_PERIOD_MS),
+		      K_MSEC(RECORD_PERIOD_MS));
+	LOG_INF("recording started");
+	return 0;
+}
+
+int record_stop(void)
+{
+	struct record_header header = {
+		.magic = RECORD_MAGIC,
+		.period_ms = RECORD_PERIOD_MS,
+	};
+	int rc;
+
+	k_mutex_lock(&record_lock, K_FOREVER);
+
+	if (record_mode == RECORD_PLAYING) {
+		record_play_abort();
+		k_mutex_unlock(&record_lock);
+		return 0;
+	}
+
+	if (record_mode != RECORD_RECORDING) {
+		k_mutex_unlock(&record_lock);
+		return -EALREADY;
+	}
+
+	k_timer_stop(&record_sample_timer);
+	grbl_set_report_interval(record_grbl, GRBL_REPORT_INTERVAL);
+	record_mode = RECORD_OFF;
+	record_put_idle();
+	record_flush_page();
+	header.length = record_offset - RECORD_PAGE_SIZE;
+	header.samples = record_samples;
+	k_mutex_unlock(&record_lock);
+
+	/* wait for the io thread to write out both pages */
+	k_sem_take(&record_page_free, K_FOREVER);
+	k_sem_take(&record_page_free, K_FOREVER);
+	rc = flash_area_write(record_fa, 0, &header, sizeof(header));
+	k_sem_give(&record_page_free);
+	k_sem_give(&record_page_free);
+
+	LOG_INF("recorded %d samples, %d bytes%s", header.samples,
+		header.length, record_full ? ", truncated" : "");
+	return rc;
+}
+
+/* record_play() checked that the recording fits the partition */
+static void record_play_read(int chunk)
+{
+	struct record_io_req req = {
+		.op = IO_READ,
+		.buf = chunk % 2,
+		.offset = RECORD_PAGE_SIZE + chunk * RECORD_CHUNK_SIZE,
+		.len = MIN(RECORD_CHUNK_SIZE,
+			   play_header.length - chunk * RECORD_CHUNK_SIZE),
+	};
+
+	k_msgq_put(&record_io_msgq, &req, K_FOREVER);
+}
+
+/*
+ * A stop resets grbl, which fails the lines waiting to be queued. A line
+ * queued completely after that reset has to be dropped here.
+ */
+static void record_play_queue(const char *cmd)
+{
+	uint32_t flush_count = grbl_flush_count(record_grbl);
+
+	if (grbl_queue_command(record_grbl, cmd) == 0) {
+		return;
+	}
+
+	k_mutex_lock(&record_lock, K_FOREVER);
+	if (record_mode != RECORD_PLAYING &&
+	    grbl_flush_count(record_grbl) == flush_count) {
+		grbl_abort_motion(record_grbl);
+	}
+	k_mutex_unlock(&record_lock);
+}
+
+static void record_play_idle(int32_t samples)
+{
+	char cmd[32];
+	int32_t ms = samples * RECORD_PERIOD_MS;
+
+	snprintk(cmd, ARRAY_SIZE(cmd), "G4 P%d.%03d\n", ms / 1000, ms % 1000);
+	record_play_queue(cmd);
+}
+
+static void record_play_segment(int32_t x, int32_t y, int32_t last_x,
+				int32_t last_y)
+{
+	char cmd[64];
+	float dx = (x - last_x) / 1000.0f;
+	float dy = (y - last_y) / 1000.0f;
+	float feed = sqrtf(dx * dx + dy * dy) * 60000.0f / RECORD_PERIOD_MS;
+
+	/* grbl rejects F0 (error 22), a keyframe may not have moved */
+	if (x == last_x && y == last_y) {
+		record_play_idle(1);
+		return;
+	}
+
+	snprintk(cmd, ARRAY_SIZE(cmd), "G53 G1 X%.3f Y%.3f F%.2f\n",
+		 x / 1000.0f, y / 1000.0f, feed);
+	record_play_queue(cmd);
+}
+
+/* Returns false once the end of the recording is reached */
+static bool record_play_chunk(const uint8_t *chunk, size_t len, int32_t *x,
+			      int32_t *y)
+{
+	for (size_t page = 0; page < len; page += RECORD_PAGE_SIZE) {
+		const uint8_t *p = &chunk[page];
+		const uint8_t *end = p + RECORD_PAGE_SIZE;
+
+		while (p < end && *p != REC_ERASED) {
+			int32_t last_x = *x, last_y = *y;
+			int32_t value;
+
+			if (record_mode != RECORD_PLAYING) {
+				return false;
+			}
+
+			switch (*p++) {
+			case REC_KEYFRAME:
+				*x = sys_get_le32(p);
+				*y = sys_get_le32(p + 4);
+				p += 8;
+				record_play_segment(*x, *y, last_x, last_y);
+				break;
+			case REC_DELTA:
+				p = record_get_varint(p, &value);
+				*x += value;
+				p = record_get_varint(p, &value);
+				*y += value;
+				record_play_segment(*x, *y, last_x, last_y);
+				break;
+			case REC_IDLE:
+				p = record_get_varint(p, &value);
+				record_play_idle(value);
+				break;
+			case REC_COMMAND:
+				/* positions are replayed from the samples */
+				p += sizeof(struct visca_command);
+				break;
+			default:
+				LOG_ERR("corrupt recording");
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+static void record_play_worker(void *p1, void *p2, void *p3)
+{
+	while (true) {
+		k_sem_take(&record_play_sem, K_FOREVER);
+
+		int chunks = DIV_ROUND_UP(play_header.length,
+					  RECORD_CHUNK_SIZE);
+		struct Position start;
+		int32_t x, y;
+		int requested = 0, done = 0;
+
+		k_sem_reset(record_chunk_full[0]);
+		k_sem_reset(record_chunk_full[1]);
+		while (requested < MIN(2, chunks)) {
+			record_play_read(requested++);
+		}
+
+		/* get to the start position gently */
+		k_sem_take(record_chunk_full[0], K_FOREVER);
+		if (record_chunk[0][0] != REC_KEYFRAME) {
+			LOG_ERR("recording doesn't start with a keyframe");
+			record_mode = RECORD_OFF;
+		}
+		x = sys_get_le32(&record_chunk[0][1]);
+		y = sys_get_le32(&record_chunk[0][5]);
+		start.x = x / 1000.0f;
+		start.y = y / 1000.0f;
+		k_sem_give(record_chunk_full[0]);
+
+		if (record_mode == RECORD_PLAYING) {
+			motion_move_timed(record_grbl, &start, 2000, true);
+		}
+
+		while (done < chunks && record_mode == RECORD_PLAYING) {
+			int i = done++;
+			size_t len = MIN(RECORD_CHUNK_SIZE,
+					 play_header.length -
+						 i * RECORD_CHUNK_SIZE);
+
+			k_sem_take(record_chunk_full[i % 2], K_FOREVER);
+
+			if (!record_play_chunk(record_chunk[i % 2], len, &x,
+					       &y)) {
+				break;
+			}
+
+			if (requested < chunks) {
+				record_play_read(requested++);
+			}
+		}
+
+		/*
+		 * Reads still queued would land in a buffer of the next
+		 * playback, the io thread signals each of them as it finishes.
+		 */
+		while (done < requested) {
+			k_sem_take(record_chunk_full[done++ % 2], K_FOREVER);
+		}
+
+		LOG_INF("playback finished");
+		k_mutex_lock(&record_lock, K_FOREVER);
+		record_mode = RECORD_OFF;
+		k_mutex_unlock(&record_lock);
+	}
+}
+
+int record_play(struct grbl_ctx *grbl)
+{
+	int rc;
+
+	k_mutex_lock(&record_lock, K_FOREVER);
+
+	if (record_mode != RECORD_OFF) {
+		k_mutex_unlock(&record_lock);
+		return -EBUSY;
+	}
+
+	rc = flash_area_read(record_fa, 0, &play_header, sizeof(play_header));
+	if (rc != 0) {
+		k_mutex_unlock(&record_lock);
+		return rc;
+	}
+
+	if (play_header.magic != RECORD_MAGIC ||
+	    play_header.period_ms != RECORD_PERIOD_MS ||
+	    play_header.length == 0 ||
+	    play_header.length > record_size - RECORD_PAGE_SIZE) {
+		k_mutex_unlock(&record_lock);
+		LOG_ERR("no valid recording");
+		return -ENOENT;
+	}
+
+	record_grbl = grbl;
+	record_mode = RECORD_PLAYING;
+	k_mutex_unlock(&record_lock);
+
+	k_sem_give(&record_play_sem);
+	return 0;
+}
+
+static void record_io_worker(void *p1, void *p2, void *p3)
+{
+	struct record_io_req req;
+	int rc;
+
+	while (true) {
+		k_msgq_get(&record_io_msgq, &req, K_FOREVER);
+
+		if (req.op == IO_READ) {
+			rc = flash_area_read(record_fa, req.offset,
+					     record_chunk[req.buf], req.len);
+			if (rc != 0) {
+				LOG_ERR("flash read failed. rc: %d", rc);
+			}
+			k_sem_give(record_chunk_full[req.buf]);
+			continue;
+		}
+
+		/* erase sectors lazily when the log reaches them */
+		if (req.offset % RECORD_SECTOR_SIZE == 0) {
+			rc = flash_area_erase(record_fa, req.offset,
+					      RECORD_SECTOR_SIZE);
+			if (rc != 0) {
+				LOG_ERR("flash erase failed. rc: %d", rc);
+			}
+		}
+
+		rc = flash_area_write(record_fa, req.offset,
+				      record_page[req.buf], req.len);
+		if (rc != 0) {
+			LOG_ERR("flash write failed. rc: %d", rc);
+		}
+		k_sem_give(&record_page_free);
+	}
+}
+
+K_THREAD_DEFINE(record_io_thread, RECORD_STACK_SIZE, record_io_worker, NULL,
+		NULL, NULL, 1, 0, 0);
+K_THREAD_DEFINE(record_play_thread, RECORD_STACK_SIZE, record_play_worker,
+		NULL, NULL, NULL, 0, 0, 0);
+
+int record_init(void)
+{
+	int rc = flash_area_open(FLASH_AREA_ID(storage), &record_fa);
+
+	if (rc != 0) {
+		LOG_ERR("unable to open storage partition. rc: %d", rc);
+		return rc;
+	}
+
+	record_size = ROUND_DOWN(record_fa->fa_size, RECORD_SECTOR_SIZE);
+	return 0;
+}
+
+static int cmd_record_start(const struct shell *sh, size_t argc, char **argv)
+{
+	struct grbl_ctx *grbl = head_get_grbl(strtoul(argv[1], NULL, 0));
+
+	if (grbl == NULL) {
+		shell_error(sh, "no head with address %s", argv[1]);
+		return -EINVAL;
+	}
+
+	return record_start(grbl);
+}
+
+static int cmd_record_stop(const struct shell *sh, size_t argc, char **argv)
+{
+	return record_stop();
+}
+
+static int cmd_record_play(const struct shell *sh, size_t argc, char **argv)
+{
+	struct grbl_ctx *grbl = head_get_grbl(strtoul(argv[1], NULL, 0));
+
+	if (grbl == NULL) {
+		shell_error(sh, "no head with address %s", argv[1]);
+		return -EINVAL;
+	}
+
+	return record_play(grbl);
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	record_cmds,
+	SHELL_CMD_ARG(start, NULL, "Record motion of a head. usage: start <addr>",
+		      cmd_record_start, 2, 0),
+	SHELL_CMD(stop, NULL, "Stop recording or playback", cmd_record_stop),
+	SHELL_CMD_ARG(play, NULL, "Play back the recording. usage: play <addr>",
+		      cmd_record_play, 2, 0),
+	SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(record, &record_cmds, "Motion recording", NULL);
@@ -0,0 +1,14 @@
+#ifndef CAMPANTILT__RECORD__H
+#define CAMPANTILT__RECORD__H
+
+#include "grbl.h"
+#include "visca.h"
+
+int record_init(void);
+int record_start(struct grbl_ctx *grbl);
+int record_stop(void);
+int record_play(struct grbl_ctx *grbl);
+bool record_is_active(struct grbl_ctx *grbl);
+void record_command(struct grbl_ctx *grbl, const struct visca_command *cmd);
+
+#endif
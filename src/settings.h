@@ -1,14 +1,25 @@
 #ifndef CAMPANTILT__SETTINGS__H
 #define CAMPANTILT__SETTINGS__H
 
+#include <stdbool.h>
 #include "grbl.h"
 
+#define SETTING_SLOTS 9
+
 struct SettingData {
 	struct Position pos;
+	/* zoom position of the camera, proxy mode only */
+	uint16_t zoom;
+	bool has_zoom;
 };
 
-int setting_get(uint8_t reg_num, struct SettingData *data);
-int setting_set(uint8_t reg_num, struct SettingData *data);
+int setting_get(struct grbl_ctx *grbl, uint8_t reg_num,
+		struct SettingData *data);
+int setting_set(struct grbl_ctx *grbl, uint8_t reg_num,
+		struct SettingData *data);
+int setting_zoom_store(uint8_t head, uint8_t slot,
+		       const struct SettingData *data);
+void setting_zoom_load(uint8_t head, uint8_t slot, struct SettingData *data);
 void setting_init();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,304 @@
+/*
+ * camera pantilt controller
+ *
+ * Copyright (c) Thomas Schmid, 2021
+ *
+ * Authors:
+ *  Thomas Schmid <tom@lfence.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 3.  See
+ * the LICENSE file in the top-level directory.
+ */
+
+/*
+ * Preset tours. Each leg (dwell at the current stop, move to the next one)
+ * is queued into grbl shortly before the previous move ends. grbl executes
+ * the G4 dwell once the planner ran empty and parses the already buffered
+ * move right after it, so the transition starts exactly on the dwell
+ * deadline. A kernel timer triggers queueing of the next leg.
+ */
+
+#include <zephyr.h>
+#include <string.h>
+#include <stdlib.h>
+#include <logging/log.h>
+#include <shell/shell.h>
+#include "tour.h"
+#include "motion.h"
+#include "head.h"
+
+LOG_MODULE_REGISTER(tour, CONFIG_LOG_DEFAULT_LEVEL);
+
+/* queue the next leg this long before the previous move ends */
+#define TOUR_LEAD_MS 500
+
+static bool tour_target(struct tour *tour, uint8_t stop, struct Position *pos)
+{
+	if (grbl_get_work_offset(tour->grbl, tour->stops[stop].slot, pos) != 0) {
+		LOG_ERR("invalid memory slot %d", tour->stops[stop].slot);
+		return false;
+	}
+
+	return true;
+}
+
+static void tour_arm(struct tour *tour)
+{
+	int64_t delay = tour->deadline - TOUR_LEAD_MS - k_uptime_get();
+
+	k_timer_start(&tour->timer, K_MSEC(MAX(delay, 0)), K_NO_WAIT);
+}
+
+/* Move to the first stop, from wherever the head is */
+static void tour_first_leg(struct tour *tour)
+{
+	const struct tour_stop *stop = &tour->stops[0];
+	int duration_ms;
+
+	if (!tour_target(tour, 0, &tour->last_target)) {
+		atomic_set(&tour->active, false);
+		return;
+	}
+
+	/* the next leg starts where this one really ends */
+	if (grbl_clamp_position(tour->grbl, &tour->last_target)) {
+		LOG_WRN("first stop out of travel, clamped");
+	}
+
+	duration_ms = motion_move_timed(
+		tour->grbl, &tour->last_target, stop->transition_ms,
+		IS_ENABLED(CONFIG_CAMERAPANTILT_PRESET_EASING));
+	if (duration_ms < 0) {
+		atomic_set(&tour->active, false);
+		return;
+	}
+
+	/* the move may have been stretched, the dwell starts once it ends */
+	tour->deadline = k_uptime_get() + duration_ms;
+	tour->next = 1 % tour->num_stops;
+}
+
+static void tour_next_leg(struct tour *tour)
+{
+	const struct tour_stop *current =
+		&tour->stops[(tour->next + tour->num_stops - 1) %
+			     tour->num_stops];
+	const struct tour_stop *stop = &tour->stops[tour->next];
+	bool eased = IS_ENABLED(CONFIG_CAMERAPANTILT_PRESET_EASING);
+	uint32_t flush_count = grbl_flush_count(tour->grbl);
+	uint32_t transition_ms;
+	struct Position target;
+	char cmd[32];
+
+	if (!tour_target(tour, tour->next, &target)) {
+		atomic_set(&tour->active, false);
+		return;
+	}
+
+	transition_ms = motion_limit_move(tour->grbl, &tour->last_target,
+					  &target, stop->transition_ms, eased);
+
+	snprintk(cmd, ARRAY_SIZE(cmd), "G4 P%d.%03d\n",
+		 current->dwell_ms / 1000, current->dwell_ms % 1000);
+
+	if (grbl_queue_command(tour->grbl, cmd) == 0 ||
+	    motion_queue_move(tour->grbl, &tour->last_target, &target,
+			      transition_ms, eased) == 0) {
+		/* grbl got reset, tour_stop() takes care of the rest */
+		return;
+	}
+
+	/*
+	 * tour_stop() may have reset grbl before the leg was queued, the
+	 * leg would run after the abort then. Drop it unless that reset
+	 * still is to come.
+	 */
+	k_mutex_lock(&tour->lock, K_FOREVER);
+	if (!atomic_get(&tour->active) &&
+	    grbl_flush_count(tour->grbl) == flush_count) {
+		grbl_abort_motion(tour->grbl);
+	}
+	k_mutex_unlock(&tour->lock);
+
+	tour->deadline += current->dwell_ms + transition_ms;
+	tour->last_target = target;
+	tour->next = (tour->next + 1) % tour->num_stops;
+}
+
+static void tour_work_handler(struct k_work *work)
+{
+	struct tour *tour = CONTAINER_OF(work, struct tour, work);
+
+	if (!atomic_get(&tour->active)) {
+		return;
+	}
+
+	if (tour->deadline == 0) {
+		tour_first_leg(tour);
+	} else {
+		tour_next_leg(tour);
+	}
+
+	if (atomic_get(&tour->active)) {
+		tour_arm(tour);
+	}
+}
+
+static void tour_timer_expr(struct k_timer *timer)
+{
+	struct tour *tour = CONTAINER_OF(timer, struct tour, timer);
+
+	k_work_submit_to_queue(&tour->work_q, &tour->work);
+}
+
+int tour_add(struct tour *tour, uint8_t slot, uint32_t dwell_ms,
+	     uint32_t transition_ms)
+{
+	if (atomic_get(&tour->active)) {
+		return -EBUSY;
+	}
+
+	if (tour->num_stops >= TOUR_MAX_STOPS) {
+		return -ENOMEM;
+	}
+
+	tour->stops[tour->num_stops++] = (struct tour_stop){
+		.slot = slot,
+		.dwell_ms = dwell_ms,
+		.transition_ms = MAX(transition_ms, 1),
+	};
+	return 0;
+}
+
+void tour_clear(struct tour *tour)
+{
+	tour_stop(tour);
+	tour->num_stops = 0;
+}
+
+int tour_start(struct tour *tour)
+{
+	if (tour->num_stops == 0) {
+		return -ENOENT;
+	}
+
+	if (!atomic_cas(&tour->active, false, true)) {
+		return -EALREADY;
+	}
+
+	LOG_INF("tour started");
+	tour->deadline = 0;
+	tour->next = 0;
+	k_work_submit_to_queue(&tour->work_q, &tour->work);
+	return 0;
+}
+
+/* Stop the tour and drop the legs already queued in grbl */
+void tour_stop(struct tour *tour)
+{
+	if (!atomic_cas(&tour->active, true, false)) {
+		return;
+	}
+
+	LOG_INF("tour stopped");
+	k_timer_stop(&tour->timer);
+	k_mutex_lock(&tour->lock, K_FOREVER);
+	grbl_abort_motion(tour->grbl);
+	k_mutex_unlock(&tour->lock);
+}
+
+void tour_init(struct tour *tour, struct grbl_ctx *grbl)
+{
+	tour->grbl = grbl;
+	tour->num_stops = 0;
+	atomic_set(&tour->active, false);
+
+	k_mutex_init(&tour->lock);
+	k_timer_init(&tour->timer, tour_timer_expr, NULL);
+	k_work_init(&tour->work, tour_work_handler);
+	k_work_queue_start(&tour->work_q, tour->stack,
+			   K_KERNEL_STACK_SIZEOF(tour->stack), 0, NULL);
+}
+
+static struct tour *tour_get(const struct shell *sh, const char *addr)
+{
+	struct tour *tour = head_get_tour(strtoul(addr, NULL, 0));
+
+	if (tour == NULL) {
+		shell_error(sh, "no head with address %s", addr);
+	}
+
+	return tour;
+}
+
+static int cmd_tour_add(const struct shell *sh, size_t argc, char **argv)
+{
+	struct tour *tour = tour_get(sh, argv[1]);
+
+	if (tour == NULL) {
+		return -EINVAL;
+	}
+
+	return tour_add(tour, strtoul(argv[2], NULL, 0),
+			strtoul(argv[3], NULL, 0), strtoul(argv[4], NULL, 0));
+}
+
+static int cmd_tour_clear(const struct shell *sh, size_t argc, char **argv)
+{
+	struct tour *tour = tour_get(sh, argv[1]);
+
+	if (tour == NULL) {
+		return -EINVAL;
+	}
+
+	tour_clear(tour);
+	return 0;
+}
+
+static int cmd_tour_show(const struct shell *sh, size_t argc, char **argv)
+{
+	struct tour *tour = tour_get(sh, argv[1]);
+
+	if (tour == NULL) {
+		return -EINVAL;
+	}
+
+	for (int i = 0; i < tour->num_stops; i++) {
+		shell_print(sh, "%d: slot %d, dwell %d ms, transition %d ms", i,
+			    tour->stops[i].slot, tour->stops[i].dwell_ms,
+			    tour->stops[i].transition_ms);
+	}
+
+	shell_print(sh, "%s", atomic_get(&tour->active) ? "running" :
+							  "stopped");
+	return 0;
+}
+
+/* start and stop go through the head so they are ordered with visca */
+static int cmd_tour_run(const struct shell *sh, size_t argc, char **argv)
+{
+	struct visca_command cmd = {
+		.cmd = PTD_TOUR,
+		.payload.ptd_tour.start = strcmp(argv[0], "start") == 0,
+	};
+
+	return head_submit(strtoul(argv[1], NULL, 0), &cmd);
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	tour_cmds,
+	SHELL_CMD_ARG(add, NULL,
+		      "Append a stop\n"
+		      "usage: add <addr> <slot> <dwell ms> <transition ms>",
+		      cmd_tour_add, 5, 0),
+	SHELL_CMD_ARG(clear, NULL, "Remove all stops. usage: clear <addr>",
+		      cmd_tour_clear, 2, 0),
+	SHELL_CMD_ARG(show, NULL, "List the stops. usage: show <addr>",
+		      cmd_tour_show, 2, 0),
+	SHELL_CMD_ARG(start, NULL, "Start the tour. usage: start <addr>",
+		      cmd_tour_run, 2, 0),
+	SHELL_CMD_ARG(stop, NULL, "Stop the tour. usage: stop <addr>",
+		      cmd_tour_run, 2, 0),
+	SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(tour, &tour_cmds, "Preset tours", NULL);
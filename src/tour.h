@@ -0,0 +1,44 @@
+#ifndef CAMPANTILT__TOUR__H
+#define CAMPANTILT__TOUR__H
+
+#include <stdint.h>
+#include <zephyr.h>
+#include "grbl.h"
+
+#define TOUR_MAX_STOPS 16
+#define TOUR_STACK_SIZE CONFIG_CAMERAPANTILT_TOUR_STACK_SIZE
+
+struct tour_stop {
+	uint8_t slot;
+	uint32_t dwell_ms;
+	uint32_t transition_ms;
+};
+
+/* Endless round trip over memory slots of one head */
+struct tour {
+	struct grbl_ctx *grbl;
+	struct tour_stop stops[TOUR_MAX_STOPS];
+	uint8_t num_stops;
+	uint8_t next;
+	atomic_t active;
+	/* serializes the abort of tour_stop() with queueing a leg */
+	struct k_mutex lock;
+
+	/* uptime in ms when the last queued move ends */
+	int64_t deadline;
+	struct Position last_target;
+
+	struct k_timer timer;
+	struct k_work work;
+	struct k_work_q work_q;
+	K_KERNEL_STACK_MEMBER(stack, TOUR_STACK_SIZE);
+};
+
+void tour_init(struct tour *tour, struct grbl_ctx *grbl);
+int tour_add(struct tour *tour, uint8_t slot, uint32_t dwell_ms,
+	     uint32_t transition_ms);
+void tour_clear(struct tour *tour);
+int tour_start(struct tour *tour);
+void tour_stop(struct tour *tour);
+
+#endif
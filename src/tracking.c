@@ -0,0 +1,376 @@
+/*
+ * camera pantilt controller
+ *
+ * Copyright (c) Thomas Schmid, 2021
+ *
+ * Authors:
+ *  Thomas Schmid <tom@lfence.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 3.  See
+ * the LICENSE file in the top-level directory.
+ */
+
+/*
+ * Closed loop following of target angles sent by an external tracker.
+ *
+ * Targets arrive on the optional tracking uart as binary frames
+ *
+ *   A5 <addr> <pan:int32 le> <tilt:int32 le> <sum>
+ *
+ * with positions in VISCA position units and sum being the 8 bit sum of
+ * addr and the position bytes, or from the shell. They are converted and
+ * limited like absolute VISCA moves. Only the
+ * latest target counts. A control loop running at a fixed rate turns the
+ * position error into a jog velocity and queues one short jog per period,
+ * so the head moves continuously instead of starting and stopping for
+ * every target.
+ */
+
+#include <zephyr.h>
+#include <stdlib.h>
+#include <math.h>
+#include <logging/log.h>
+#include <drivers/uart.h>
+#include <shell/shell.h>
+#include <sys/byteorder.h>
+#include "tracking.h"
+#include "head.h"
+
+LOG_MODULE_REGISTER(tracking, CONFIG_LOG_DEFAULT_LEVEL);
+
+#define TRACKING_PERIOD_MS (1000 / CONFIG_CAMERAPANTILT_TRACKING_RATE_HZ)
+#define TRACKING_GAIN (CONFIG_CAMERAPANTILT_TRACKING_GAIN / 10.0f)
+#define TRACKING_MAX_SPEED CONFIG_CAMERAPANTILT_TRACKING_MAX_SPEED
+/* stop following if the tracker went silent */
+#define TRACKING_TIMEOUT_MS 500
+/* don't chase errors smaller than this (machine units) */
+#define TRACKING_DEADBAND 0.005f
+#define TRACKING_MAX_HEADS DT_NUM_INST_STATUS_OKAY(camerapantilt_grbl_head)
+#define TRACKING_STACK_SIZE CONFIG_CAMERAPANTILT_TRACKING_STACK_SIZE
+
+#define TRACKING_SYNC 0xA5
+#define TRACKING_FRAME_SIZE 11
+
+#define TRACKING_UART DT_HAS_CHOSEN(camerapantilt_tracking_uart)
+
+/* Bound to the grbl of a head, renumbering the heads doesn't matter */
+struct tracker {
+	struct grbl_ctx *grbl;
+	bool active;
+	struct Position target;
+	int64_t last_update;
+	uint32_t last_seq;
+	/* where the jogs queued so far end */
+	struct Position commanded;
+};
+
+static struct tracker trackers[TRACKING_MAX_HEADS];
+static struct k_spinlock tracking_lock;
+
+K_TIMER_DEFINE(tracking_timer, NULL, NULL);
+/* given when a tracker becomes active, the timer only runs while tracking */
+K_SEM_DEFINE(tracking_sem, 0, 1);
+
+#if TRACKING_UART
+static const struct device *tracking_uart =
+	DEVICE_DT_GET(DT_CHOSEN(camerapantilt_tracking_uart));
+static uint8_t tracking_frame[TRACKING_FRAME_SIZE];
+static uint8_t tracking_frame_pos;
+#endif
+
+static struct tracker *tracking_find(struct grbl_ctx *grbl)
+{
+	struct tracker *free = NULL;
+
+	for (int i = 0; i < ARRAY_SIZE(trackers); i++) {
+		if (trackers[i].grbl == grbl) {
+			return &trackers[i];
+		}
+
+		if (trackers[i].grbl == NULL && free == NULL) {
+			free = &trackers[i];
+		}
+	}
+
+	if (free != NULL) {
+		free->grbl = grbl;
+	}
+
+	return free;
+}
+
+int tracking_set_target(uint8_t visca_addr, int32_t pan, int32_t tilt)
+{
+	struct grbl_ctx *grbl = head_get_grbl(visca_addr);
+	struct Position target = { 0 };
+	struct tracker *tracker;
+	bool start = false;
+
+	if (grbl == NULL ||
+	    head_to_machine(visca_addr, pan, tilt, &target) != 0) {
+		return -ENODEV;
+	}
+
+	k_spinlock_key_t key = k_spin_lock(&tracking_lock);
+
+	tracker = tracking_find(grbl);
+	if (tracker != NULL) {
+		if (!tracker->active) {
+			tracker->active = true;
+			tracker->last_seq = 0;
+			start = true;
+		}
+
+		tracker->target = target;
+		tracker->last_update = k_uptime_get();
+	}
+
+	k_spin_unlock(&tracking_lock, key);
+
+	if (start) {
+		grbl_set_report_interval(grbl, K_MSEC(TRACKING_PERIOD_MS));
+		k_sem_give(&tracking_sem);
+	}
+
+	return tracker != NULL ? 0 : -ENOMEM;
+}
+
+/* After a tracker went inactive, not under tracking_lock */
+static void tracking_release(struct grbl_ctx *grbl)
+{
+	grbl_send_byte_no_ack(grbl, 0x85); /* jog cancel */
+	grbl_set_report_interval(grbl, GRBL_REPORT_INTERVAL);
+}
+
+void tracking_stop(struct grbl_ctx *grbl)
+{
+	k_spinlock_key_t key = k_spin_lock(&tracking_lock);
+	bool stopped = false;
+
+	for (int i = 0; i < ARRAY_SIZE(trackers); i++) {
+		if (trackers[i].active && trackers[i].grbl == grbl) {
+			trackers[i].active = false;
+			stopped = true;
+		}
+	}
+
+	k_spin_unlock(&tracking_lock, key);
+
+	if (stopped) {
+		tracking_release(grbl);
+	}
+}
+
+bool tracking_is_active(struct grbl_ctx *grbl)
+{
+	k_spinlock_key_t key = k_spin_lock(&tracking_lock);
+	bool active = false;
+
+	for (int i = 0; i < ARRAY_SIZE(trackers); i++) {
+		if (trackers[i].active && trackers[i].grbl == grbl) {
+			active = true;
+		}
+	}
+
+	k_spin_unlock(&tracking_lock, key);
+	return active;
+}
+
+static bool tracking_any_active(void)
+{
+	k_spinlock_key_t key = k_spin_lock(&tracking_lock);
+	bool active = false;
+
+	for (int i = 0; i < ARRAY_SIZE(trackers); i++) {
+		active |= trackers[i].active;
+	}
+
+	k_spin_unlock(&tracking_lock, key);
+	return active;
+}
+
+static void tracking_update(struct tracker *tracker, struct Position target)
+{
+	struct GrblState state = grbl_get_state(tracker->grbl);
+	struct Position *end = &tracker->commanded;
+	float ex, ey, error;
+	char cmd[64];
+
+	/*
+	 * grbl acks a jog once it is planned, so the error is taken against
+	 * the end of the jogs queued already. It restarts from the actual
+	 * position once they all ran.
+	 */
+	if (tracker->last_seq == 0 ||
+	    (grbl_is_acked(tracker->grbl, tracker->last_seq) &&
+	     state.state == GRBL_STATE_IDLE)) {
+		*end = state.pos_act;
+	}
+
+	/* the planner is more than two periods behind, let it catch up */
+	ex = end->x - state.pos_act.x;
+	ey = end->y - state.pos_act.y;
+	if (sqrtf(ex * ex + ey * ey) >
+	    2 * TRACKING_MAX_SPEED * TRACKING_PERIOD_MS / 1000.0f) {
+		return;
+	}
+
+	/* grbl rejects jogs beyond its travel, stop at the limit instead */
+	grbl_clamp_position(tracker->grbl, &target);
+	ex = target.x - end->x;
+	ey = target.y - end->y;
+	error = sqrtf(ex * ex + ey * ey);
+
+	if (error < TRACKING_DEADBAND) {
+		return;
+	}
+
+	/* proportional velocity, the jog covers one control period */
+	float speed = MIN(error * TRACKING_GAIN, TRACKING_MAX_SPEED);
+	float step = MIN(speed * TRACKING_PERIOD_MS / 1000.0f, error);
+	float dx = ex / error * step;
+	float dy = ey / error * step;
+
+	snprintk(cmd, ARRAY_SIZE(cmd), "$J=G91 X%.3f Y%.3f F%.1f\n", dx, dy,
+		 speed * 60);
+	tracker->last_seq = grbl_queue_command(tracker->grbl, cmd);
+	end->x += dx;
+	end->y += dy;
+}
+
+static void tracking_worker(void *p1, void *p2, void *p3)
+{
+	while (true) {
+		/* no periodic wakeups while nothing is tracked */
+		if (!tracking_any_active()) {
+			k_timer_stop(&tracking_timer);
+			k_sem_take(&tracking_sem, K_FOREVER);
+			k_timer_start(&tracking_timer,
+				      K_MSEC(TRACKING_PERIOD_MS),
+				      K_MSEC(TRACKING_PERIOD_MS));
+		}
+
+		k_timer_status_sync(&tracking_timer);
+
+		for (int i = 0; i < ARRAY_SIZE(trackers); i++) {
+			struct tracker *tracker = &trackers[i];
+			k_spinlock_key_t key = k_spin_lock(&tracking_lock);
+			bool active = tracker->active;
+			bool lost = active && k_uptime_get() -
+							tracker->last_update >
+						TRACKING_TIMEOUT_MS;
+			struct Position target = tracker->target;
+
+			if (lost) {
+				tracker->active = false;
+			}
+
+			k_spin_unlock(&tracking_lock, key);
+
+			if (lost) {
+				LOG_INF("tracker lost");
+				tracking_release(tracker->grbl);
+			} else if (active) {
+				tracking_update(tracker, target);
+			}
+		}
+	}
+}
+
+K_THREAD_DEFINE(tracking_thread, TRACKING_STACK_SIZE, tracking_worker, NULL,
+		NULL, NULL, -2, 0, 0);
+
+#if TRACKING_UART
+static void tracking_frame_received(void)
+{
+	uint8_t sum = 0;
+
+	for (int i = 1; i < TRACKING_FRAME_SIZE - 1; i++) {
+		sum += tracking_frame[i];
+	}
+
+	if (sum != tracking_frame[TRACKING_FRAME_SIZE - 1]) {
+		LOG_DBG("tracking frame checksum mismatch");
+		return;
+	}
+
+	tracking_set_target(tracking_frame[1],
+			    (int32_t)sys_get_le32(&tracking_frame[2]),
+			    (int32_t)sys_get_le32(&tracking_frame[6]));
+}
+
+static void tracking_uart_callback(const struct device *dev, void *user_data)
+{
+	uint8_t buffer[16];
+	int len;
+
+	while (uart_irq_update(dev) && uart_irq_is_pending(dev)) {
+		if (!uart_irq_rx_ready(dev)) {
+			continue;
+		}
+
+		len = uart_fifo_read(dev, buffer, sizeof(buffer));
+
+		for (int i = 0; i < len; i++) {
+			if (tracking_frame_pos == 0 &&
+			    buffer[i] != TRACKING_SYNC) {
+				continue;
+			}
+
+			tracking_frame[tracking_frame_pos++] = buffer[i];
+
+			if (tracking_frame_pos == TRACKING_FRAME_SIZE) {
+				tracking_frame_received();
+				tracking_frame_pos = 0;
+			}
+		}
+	}
+}
+#endif
+
+int tracking_init(void)
+{
+#if TRACKING_UART
+	if (!device_is_ready(tracking_uart)) {
+		LOG_ERR("tracking uart not ready");
+		return -ENODEV;
+	}
+
+	uart_irq_callback_user_data_set(tracking_uart, tracking_uart_callback,
+					NULL);
+	uart_irq_rx_enable(tracking_uart);
+#endif
+	return 0;
+}
+
+static int cmd_track_target(const struct shell *sh, size_t argc, char **argv)
+{
+	return tracking_set_target(strtoul(argv[1], NULL, 0),
+				   strtol(argv[2], NULL, 0),
+				   strtol(argv[3], NULL, 0));
+}
+
+static int cmd_track_stop(const struct shell *sh, size_t argc, char **argv)
+{
+	struct grbl_ctx *grbl = head_get_grbl(strtoul(argv[1], NULL, 0));
+
+	if (grbl == NULL) {
+		shell_error(sh, "no head with address %s", argv[1]);
+		return -EINVAL;
+	}
+
+	tracking_stop(grbl);
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	track_cmds,
+	SHELL_CMD_ARG(target, NULL,
+		      "Follow a target in VISCA pan and tilt positions\n"
+		      "usage: target <addr> <pan> <tilt>",
+		      cmd_track_target, 4, 0),
+	SHELL_CMD_ARG(stop, NULL, "Stop following. usage: stop <addr>",
+		      cmd_track_stop, 2, 0),
+	SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(track, &track_cmds, "External tracking input", NULL);
@@ -0,0 +1,13 @@
+#ifndef CAMPANTILT__TRACKING__H
+#define CAMPANTILT__TRACKING__H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "grbl.h"
+
+int tracking_init(void);
+int tracking_set_target(uint8_t visca_addr, int32_t pan, int32_t tilt);
+void tracking_stop(struct grbl_ctx *grbl);
+bool tracking_is_active(struct grbl_ctx *grbl);
+
+#endif
@@ -3,15 +3,23 @@
 
 LOG_MODULE_REGISTER(visca, CONFIG_LOG_DEFAULT_LEVEL);
 
-static uint16_t get_pos(struct visca_packet_raw *raw_packet, int offset)
+/* 16 bit values are sent as four bytes 0p 0q 0r 0s, msb first */
+uint16_t visca_decode_nibbles(const uint8_t *data)
 {
-	uint16_t pos = 0;
+	uint16_t value = 0;
 
 	for (int i = 0; i < 4; i++) {
-		pos += raw_packet->data[offset + 3 - i] << i;
+		value = (value << 4) | (data[i] & 0x0F);
 	}
 
-	return pos;
+	return value;
+}
+
+void visca_encode_nibbles(uint16_t value, uint8_t *data)
+{
+	for (int i = 0; i < 4; i++) {
+		data[i] = (value >> (12 - 4 * i)) & 0x0F;
+	}
 }
 
 int visca_raw_packet_to_command(struct visca_packet_raw *raw_packet,
@@ -22,8 +30,9 @@ int visca_raw_packet_to_command(struct visca_packet_raw *raw_packet,
 	    raw_packet->data[1] == 0x06 && raw_packet->data[2] == 0x01) {
 		/* Jog commands */
 		if (raw_packet->data[2] == 1) {
-			uint16_t id = (raw_packet->data[6] << 8) +
-				      raw_packet->data[5];
+			/* pan direction, tilt direction */
+			uint16_t id = (raw_packet->data[5] << 8) +
+				      raw_packet->data[6];
 			switch (id) {
 			case 0x0101:
 				cmd->cmd = PTD_UPLEFT;
@@ -75,15 +84,16 @@ int visca_raw_packet_to_command(struct visca_packet_raw *raw_packet,
 	}
 
 	/* Pan Tilt Position Command */
-	if (raw_packet->length == 13 &&
+	if (raw_packet->length == 13 && raw_packet->data[0] == 0x01 &&
+	    raw_packet->data[1] == 0x06 &&
 	    (raw_packet->data[2] == 0x02 || raw_packet->data[2] == 0x03)) {
 		/* Abs Positionig command */
 		if (raw_packet->data[2] == 0x02) {
 			cmd->cmd = PTD_ABS;
 			cmd->payload.ptd_abs_motion.pan_pos =
-				get_pos(raw_packet, 5);
+				visca_decode_nibbles(&raw_packet->data[5]);
 			cmd->payload.ptd_abs_motion.tilt_pos =
-				get_pos(raw_packet, 9);
+				visca_decode_nibbles(&raw_packet->data[9]);
 			cmd->payload.ptd_abs_motion.pan_speed =
 				raw_packet->data[3];
 			cmd->payload.ptd_abs_motion.titlt_speed =
@@ -95,9 +105,9 @@ int visca_raw_packet_to_command(struct visca_packet_raw *raw_packet,
 		if (raw_packet->data[2] == 0x03) {
 			cmd->cmd = PTD_REL;
 			cmd->payload.ptd_rel_motion.pan_pos =
-				get_pos(raw_packet, 5);
+				visca_decode_nibbles(&raw_packet->data[5]);
 			cmd->payload.ptd_rel_motion.tilt_pos =
-				get_pos(raw_packet, 9);
+				visca_decode_nibbles(&raw_packet->data[9]);
 			cmd->payload.ptd_rel_motion.pan_speed =
 				raw_packet->data[3];
 			cmd->payload.ptd_rel_motion.titlt_speed =
@@ -119,6 +129,20 @@ int visca_raw_packet_to_command(struct visca_packet_raw *raw_packet,
 		}
 	}
 
+	/* Tour start/stop, vendor extension: 8x 01 06 50 0p FF */
+	if (raw_packet->length == 4 && raw_packet->data[0] == 0x01 &&
+	    raw_packet->data[1] == 0x06 && raw_packet->data[2] == 0x50) {
+		cmd->cmd = PTD_TOUR;
+		cmd->payload.ptd_tour.start = raw_packet->data[3] == 0x01;
+		return 0;
+	}
+
+	if (raw_packet->length == 3 && raw_packet->data[0] == 0x09 &&
+	    raw_packet->data[1] == 0x06 && raw_packet->data[2] == 0x12) {
+		cmd->cmd = PTD_POS_INQ;
+		return 0;
+	}
+
 	if (raw_packet->length == 5 && raw_packet->data[0] == 0x01 &&
 	    raw_packet->data[1] == 0x04 && raw_packet->data[2] == 0x3f &&
 	    raw_packet->data[3] == 0x01) {
@@ -1,3 +1,6 @@
+#ifndef CAMPANTILT__VISCA__H
+#define CAMPANTILT__VISCA__H
+
 #include <stdint.h>
 
 enum visca_commands {
@@ -15,7 +18,11 @@ enum visca_commands {
 	PTD_HOME,
 	PTD_RESET,
 	CAM_MEMORY_SET,
-	CAM_MEMORY_RECALL
+	CAM_MEMORY_RECALL,
+	PTD_POS_INQ,
+	PTD_TOUR,
+	/* not part of visca, issued from the shell */
+	PTD_ABS_TIMED
 };
 
 struct visca_packet_raw {
@@ -36,6 +43,18 @@ struct visca_ptd_abs_rel_motion {
 	uint32_t tilt_pos;
 } __attribute__((packed));
 
+struct visca_ptd_timed_motion {
+	/* VISCA position units, like absolute moves */
+	int32_t pan_pos;
+	int32_t tilt_pos;
+	uint32_t duration_ms;
+	uint8_t eased;
+} __attribute__((packed));
+
+struct visca_ptd_tour {
+	uint8_t start;
+} __attribute__((packed));
+
 struct visca_cam_memory {
 	uint8_t memory_slot;
 } __attribute__((packed));
@@ -46,9 +65,15 @@ struct visca_command {
 		struct visca_ptd_jog_motion ptd_jog_motion;
 		struct visca_ptd_abs_rel_motion ptd_abs_motion;
 		struct visca_ptd_abs_rel_motion ptd_rel_motion;
+		struct visca_ptd_timed_motion ptd_timed_motion;
 		struct visca_cam_memory cam_memory;
+		struct visca_ptd_tour ptd_tour;
 	} payload;
 };
 
 int visca_raw_packet_to_command(struct visca_packet_raw *raw_packet,
-				struct visca_command *cmd);
\ No newline at end of file
+				struct visca_command *cmd);
+uint16_t visca_decode_nibbles(const uint8_t *data);
+void visca_encode_nibbles(uint16_t value, uint8_t *data);
+
+#endif
@@ -0,0 +1,818 @@
+/*
+ * camera pantilt controller
+ *
+ * Copyright (c) Thomas Schmid, 2021
+ *
+ * Authors:
+ *  Thomas Schmid <tom@lfence.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 3.  See
+ * the LICENSE file in the top-level directory.
+ */
+
+/*
+ * VISCA network handling. The controller is connected to the visca uart,
+ * further devices of the daisy chain to the optional chain uart. Frames
+ * addressed to one of our heads are decoded, frames for other devices are
+ * passed downstream as they arrive and everything the chain sends back is
+ * passed upstream.
+ *
+ * In proxy mode the chain uart connects the camera mounted on the head.
+ * Frames for the head that it can't handle itself are cut through to the
+ * camera and the replies of the camera are returned on behalf of the head.
+ *
+ * Controllers may speak Pelco-D or Pelco-P on the visca uart instead. The
+ * decoders of the other protocols watch the received bytes all the time.
+ * The port switches to Pelco after several back to back frames while the
+ * VISCA parser is not inside a frame, and back to VISCA on the next valid
+ * VISCA frame for us. Pelco has no replies, only local replies depend on
+ * the protocol, the chain is forwarded either way.
+ */
+
+#include <zephyr.h>
+#include <string.h>
+#include <logging/log.h>
+#include <drivers/uart.h>
+#include <sys/ring_buffer.h>
+#include "visca.h"
+#include "visca_port.h"
+#include "head.h"
+#include "pelco.h"
+
+LOG_MODULE_REGISTER(visca_port, CONFIG_LOG_DEFAULT_LEVEL);
+
+#define VISCA_LINK_BUF_SIZE CONFIG_CAMERAPANTILT_VISCA_BUF_SIZE
+
+#define VISCA_ADDRESS_SET 0x30
+#define VISCA_IF_CLEAR 0x01
+#define VISCA_INQUIRY 0x09
+/* replies of the camera to requests of the heads */
+#define VISCA_CAMERA_TIMEOUT_MS 200
+/* 0xFF syncs Pelco-D and ends VISCA frames, one checksum match is luck */
+#define PELCO_DETECT_FRAMES 3
+
+#define VISCA_DOWNSTREAM DT_HAS_CHOSEN(camerapantilt_visca_chain_uart)
+#define VISCA_PROXY IS_ENABLED(CONFIG_CAMERAPANTILT_VISCA_PROXY)
+#define VISCA_CHAIN (VISCA_DOWNSTREAM && !VISCA_PROXY)
+
+BUILD_ASSERT(VISCA_DOWNSTREAM || !VISCA_PROXY,
+	     "visca proxy mode needs camerapantilt,visca-chain-uart");
+
+/*
+ * One side of the chain. Frames are either passed through from the other
+ * side or generated locally. The tx interrupt only switches between both
+ * sources on frame boundaries so frames never get interleaved.
+ */
+struct visca_link {
+	const struct device *uart;
+	struct ring_buf fwd_buf;
+	struct ring_buf local_buf;
+	struct ring_buf *tx_src;
+	struct k_spinlock lock;
+	uint8_t fwd_data[VISCA_LINK_BUF_SIZE];
+	uint8_t local_data[VISCA_LINK_BUF_SIZE];
+};
+
+enum visca_route {
+	ROUTE_UNDECIDED,
+	ROUTE_LOCAL,
+	ROUTE_CAMERA,
+};
+
+/* What to do with replies of the camera in proxy mode */
+enum visca_capture {
+	CAPTURE_NONE,
+	CAPTURE_SWALLOW,
+	CAPTURE_REPLY,
+};
+
+enum visca_parser_state {
+	WAIT_FOR_ADDR,
+	READ_DATA,
+	FORWARD_DATA,
+	SKIP_DATA,
+};
+
+enum port_protocol {
+	PROTOCOL_VISCA,
+	PROTOCOL_PELCO_D,
+	PROTOCOL_PELCO_P,
+};
+
+RING_BUF_DECLARE(visca_rxbuf, VISCA_LINK_BUF_SIZE);
+
+static struct visca_link upstream = {
+	.uart = DEVICE_DT_GET(DT_CHOSEN(camerapantilt_visca_uart)),
+};
+
+#if VISCA_DOWNSTREAM
+static struct visca_link downstream = {
+	.uart = DEVICE_DT_GET(DT_CHOSEN(camerapantilt_visca_chain_uart)),
+};
+#endif
+
+static enum visca_parser_state parser_state = WAIT_FOR_ADDR;
+static struct visca_packet_raw received_packet;
+
+static enum port_protocol port_protocol = PROTOCOL_VISCA;
+static struct pelco_decoder pelco_d;
+static struct pelco_decoder pelco_p;
+/* per protocol: bytes since the last valid frame, back to back frames */
+static uint8_t pelco_gap[3];
+static uint8_t pelco_frames[3];
+
+#if VISCA_PROXY
+/* head the camera currently answers for */
+static uint8_t proxy_head_addr;
+static bool camera_frame_start = true;
+
+static atomic_t camera_capture;
+/* socket of the request in flight, -1 until the camera acknowledged it */
+static int camera_socket;
+/* sockets of swallowed commands still running, e.g. a zoom direct */
+static atomic_t camera_swallowed;
+static uint8_t camera_reply[VISCA_FRAME_MAX];
+static size_t camera_reply_len;
+/* the answer to the inquiry in flight, camera_reply collects the next */
+static uint8_t camera_answer[VISCA_FRAME_MAX];
+static size_t camera_answer_len;
+K_SEM_DEFINE(camera_reply_sem, 0, 1);
+K_MUTEX_DEFINE(camera_request_mutex);
+
+static void camera_capture_timer_expr(struct k_timer *timer);
+K_TIMER_DEFINE(camera_capture_timer, camera_capture_timer_expr, NULL);
+#endif
+
+static void visca_link_irq_tx(struct visca_link *link)
+{
+	uint8_t *data;
+	uint32_t len;
+	uint32_t sent;
+
+	if (link->tx_src == NULL) {
+		if (!ring_buf_is_empty(&link->local_buf)) {
+			link->tx_src = &link->local_buf;
+		} else if (!ring_buf_is_empty(&link->fwd_buf)) {
+			link->tx_src = &link->fwd_buf;
+		} else {
+			uart_irq_tx_disable(link->uart);
+			return;
+		}
+	}
+
+	len = ring_buf_get_claim(link->tx_src, &data, VISCA_LINK_BUF_SIZE);
+
+	if (len == 0) {
+		/* rest of the frame has not arrived yet */
+		uart_irq_tx_disable(link->uart);
+		return;
+	}
+
+	for (uint32_t i = 0; i < len; i++) {
+		if (data[i] == VISCA_TERMINATOR) {
+			len = i + 1;
+			break;
+		}
+	}
+
+	sent = uart_fifo_fill(link->uart, data, len);
+	ring_buf_get_finish(link->tx_src, sent);
+
+	if (sent == len && data[len - 1] == VISCA_TERMINATOR) {
+		link->tx_src = NULL;
+	}
+}
+
+static int visca_link_put(struct visca_link *link, struct ring_buf *buf,
+			  const uint8_t *data, size_t len)
+{
+	k_spinlock_key_t key = k_spin_lock(&link->lock);
+	int rc = 0;
+
+	if (ring_buf_space_get(buf) < len) {
+		rc = -ENOMEM;
+	} else {
+		ring_buf_put(buf, data, len);
+		uart_irq_tx_enable(link->uart);
+	}
+
+	k_spin_unlock(&link->lock, key);
+	return rc;
+}
+
+/*
+ * Unlike the upstream direction this copies. The parser has to see every
+ * byte before it knows where a frame goes, and frames for our heads or in
+ * other protocols sit between the forwarded ones in the same read. Reading
+ * straight into the chain buffer would mean compacting it in place, which
+ * costs the same memmove at 9600 baud.
+ */
+static void visca_forward(const uint8_t *data, size_t len)
+{
+#if VISCA_DOWNSTREAM
+	if (visca_link_put(&downstream, &downstream.fwd_buf, data, len) != 0) {
+		LOG_ERR("chain buffer full. Dropping data");
+	}
+#endif
+}
+
+/* returns true if the frame was fully handled by the network layer */
+static bool visca_handle_broadcast(void)
+{
+	uint8_t frame[] = { received_packet.addr, VISCA_ADDRESS_SET, 0,
+			    VISCA_TERMINATOR };
+
+	/* AddressSet: take our addresses and pass the next one on */
+	if (received_packet.length == 2 &&
+	    received_packet.data[0] == VISCA_ADDRESS_SET) {
+		frame[2] = head_assign_addresses(received_packet.data[1]);
+		LOG_INF("address set. next address %d", frame[2]);
+
+		if (VISCA_CHAIN) {
+			visca_forward(frame, sizeof(frame));
+		} else {
+			visca_port_send(frame, sizeof(frame));
+		}
+		return true;
+	}
+
+	/* IF_Clear and broadcast commands travel the whole chain */
+	if (VISCA_CHAIN) {
+		visca_forward(&received_packet.addr, 1);
+		visca_forward(received_packet.data, received_packet.length);
+		visca_forward(&frame[3], 1);
+	}
+
+	if (received_packet.length == 3 &&
+	    received_packet.data[0] == VISCA_IF_CLEAR) {
+		static const uint8_t if_clear[] = { 0x88, VISCA_IF_CLEAR, 0x00,
+						    0x01, VISCA_TERMINATOR };
+
+		/* the last device of the chain returns it to the controller */
+		if (!VISCA_CHAIN) {
+			visca_port_send(if_clear, sizeof(if_clear));
+		}
+		return true;
+	}
+
+	return false;
+}
+
+#if VISCA_PROXY
+/* Pan/tilt (category 06) and memory (04 3F) frames stay with the head */
+static enum visca_route visca_proxy_route(void)
+{
+	const uint8_t *data = received_packet.data;
+
+	if ((received_packet.addr & 0x0F) == VISCA_ADDR_BROADCAST ||
+	    received_packet.length < 2) {
+		return ROUTE_UNDECIDED;
+	}
+
+	if (data[1] == 0x06) {
+		return ROUTE_LOCAL;
+	}
+
+	if (data[1] != 0x04) {
+		return ROUTE_CAMERA;
+	}
+
+	if (received_packet.length < 3) {
+		return ROUTE_UNDECIDED;
+	}
+
+	return data[2] == 0x3F ? ROUTE_LOCAL : ROUTE_CAMERA;
+}
+
+/* Pass the bytes of the frame read so far on to the camera */
+static void visca_proxy_forward_head(void)
+{
+	uint8_t header = 0x80 | CONFIG_CAMERAPANTILT_VISCA_PROXY_CAMERA_ADDR;
+
+	proxy_head_addr = received_packet.addr & 0x0F;
+	visca_forward(&header, 1);
+	visca_forward(received_packet.data, received_packet.length);
+}
+#endif
+
+static void visca_handle_frame(void)
+{
+	struct visca_command *visca_cmd;
+	uint8_t addr = received_packet.addr & 0x0F;
+
+	if (addr == VISCA_ADDR_BROADCAST && visca_handle_broadcast()) {
+		return;
+	}
+
+	visca_cmd = head_command_alloc();
+
+	if (visca_cmd == NULL) {
+		return;
+	}
+
+	if (visca_raw_packet_to_command(&received_packet, visca_cmd) != 0) {
+		head_command_free(visca_cmd);
+#if VISCA_PROXY
+		if (addr != VISCA_ADDR_BROADCAST) {
+			uint8_t terminator = VISCA_TERMINATOR;
+
+			visca_proxy_forward_head();
+			visca_forward(&terminator, 1);
+			return;
+		}
+#endif
+		LOG_INF("unable to parse visca command");
+		return;
+	}
+
+	head_command_submit(addr, visca_cmd);
+}
+
+static void port_set_protocol(enum port_protocol protocol)
+{
+	static const char *const names[] = { "visca", "pelco-d", "pelco-p" };
+
+	if (protocol == port_protocol) {
+		return;
+	}
+
+	LOG_INF("controller speaks %s", names[protocol]);
+	port_protocol = protocol;
+}
+
+/*
+ * VISCA has no checksum. While on another protocol only frames for us
+ * that decode to a known command switch back, Pelco data rarely does.
+ */
+static bool visca_frame_valid(void)
+{
+	struct visca_command visca_cmd;
+	const uint8_t *data = received_packet.data;
+
+	if ((received_packet.addr & 0x0F) == VISCA_ADDR_BROADCAST &&
+	    received_packet.length > 0 &&
+	    (data[0] == VISCA_ADDRESS_SET || data[0] == VISCA_IF_CLEAR)) {
+		return true;
+	}
+
+	return visca_raw_packet_to_command(&received_packet, &visca_cmd) == 0;
+}
+
+static void pelco_rx(struct pelco_decoder *dec, enum port_protocol protocol,
+		     uint8_t data)
+{
+	struct visca_command *cmd;
+	uint8_t addr;
+
+	uint8_t size = protocol == PROTOCOL_PELCO_D ? PELCO_D_FRAME_SIZE :
+						    PELCO_P_FRAME_SIZE;
+
+	pelco_gap[protocol] = MIN(pelco_gap[protocol] + 1, UINT8_MAX);
+
+	if (!pelco_decoder_feed(dec, data)) {
+		/* wake the head while the rest of the frame arrives */
+		if (port_protocol == protocol && dec->pos == 2 &&
+		    pelco_decoder_addr(dec, &addr)) {
+			head_wake(addr);
+		}
+		return;
+	}
+
+	if (pelco_gap[protocol] == size) {
+		pelco_frames[protocol] =
+			MIN(pelco_frames[protocol] + 1, PELCO_DETECT_FRAMES);
+	} else {
+		pelco_frames[protocol] = 1;
+	}
+	pelco_gap[protocol] = 0;
+
+	if (port_protocol != protocol) {
+		if (pelco_frames[protocol] < PELCO_DETECT_FRAMES ||
+		    (parser_state != WAIT_FOR_ADDR &&
+		     parser_state != SKIP_DATA)) {
+			return;
+		}
+
+		port_set_protocol(protocol);
+	}
+
+	pelco_decoder_addr(dec, &addr);
+
+	if (!head_is_local(addr)) {
+		return;
+	}
+
+	cmd = head_command_alloc();
+
+	if (cmd == NULL) {
+		return;
+	}
+
+	if (pelco_frame_to_command(dec, cmd) != 0) {
+		head_command_free(cmd);
+		return;
+	}
+
+	head_command_submit(addr, cmd);
+}
+
+static uint32_t visca_parse(const uint8_t *buffer, uint32_t len)
+{
+	uint32_t fwd_start = 0;
+
+	for (uint32_t i = 0; i < len; i++) {
+		uint8_t data = buffer[i];
+
+		if (IS_ENABLED(CONFIG_CAMERAPANTILT_PELCO)) {
+			pelco_rx(&pelco_d, PROTOCOL_PELCO_D, data);
+			pelco_rx(&pelco_p, PROTOCOL_PELCO_P, data);
+		}
+
+		bool active = port_protocol == PROTOCOL_VISCA;
+
+		if (parser_state == WAIT_FOR_ADDR) {
+			if (data < 0x81 || data > 0x8F) {
+				continue;
+			}
+
+			received_packet.addr = data;
+			received_packet.length = 0;
+
+			if ((data & 0x0F) == VISCA_ADDR_BROADCAST ||
+			    head_is_local(data & 0x0F)) {
+				/* wake grbl while the rest of the frame arrives */
+				if (active) {
+					head_wake(data & 0x0F);
+				}
+				parser_state = READ_DATA;
+			} else if (VISCA_CHAIN) {
+				parser_state = FORWARD_DATA;
+				fwd_start = i;
+			} else {
+				parser_state = SKIP_DATA;
+			}
+			continue;
+		}
+
+		if (parser_state == FORWARD_DATA) {
+			if (data == VISCA_TERMINATOR) {
+				visca_forward(&buffer[fwd_start],
+					      i - fwd_start + 1);
+				parser_state = WAIT_FOR_ADDR;
+			}
+			continue;
+		}
+
+		if (parser_state == SKIP_DATA) {
+			if (data == VISCA_TERMINATOR) {
+				parser_state = WAIT_FOR_ADDR;
+			}
+			continue;
+		}
+
+		if (data == VISCA_TERMINATOR) {
+			parser_state = WAIT_FOR_ADDR;
+
+			if (active || visca_frame_valid()) {
+				port_set_protocol(PROTOCOL_VISCA);
+				pelco_frames[PROTOCOL_PELCO_D] = 0;
+				pelco_frames[PROTOCOL_PELCO_P] = 0;
+				visca_handle_frame();
+			}
+			continue;
+		}
+
+		if (received_packet.length >= ARRAY_SIZE(received_packet.data)) {
+			LOG_INF("visca frame too long. Dropping");
+			parser_state = SKIP_DATA;
+			continue;
+		}
+
+		received_packet.data[received_packet.length++] = data;
+
+#if VISCA_PROXY
+		/* cut camera frames through as soon as they are recognised */
+		if (active && visca_proxy_route() == ROUTE_CAMERA) {
+			visca_proxy_forward_head();
+			parser_state = FORWARD_DATA;
+			fwd_start = i + 1;
+		}
+#endif
+	}
+
+	/* pass on what we already have of a frame crossing the chunk end */
+	if (parser_state == FORWARD_DATA && fwd_start < len) {
+		visca_forward(&buffer[fwd_start], len - fwd_start);
+	}
+
+	return len;
+}
+
+static void visca_upstream_irq_rx(void)
+{
+	uint8_t *buffer;
+	uint32_t bsize =
+		ring_buf_put_claim(&visca_rxbuf, &buffer, visca_rxbuf.size);
+	int rsize = uart_fifo_read(upstream.uart, buffer, bsize);
+	ring_buf_put_finish(&visca_rxbuf, rsize);
+
+	uint32_t numreceived;
+
+	while ((numreceived = ring_buf_get_claim(&visca_rxbuf, &buffer,
+						 visca_rxbuf.size)) > 0) {
+		ring_buf_get_finish(&visca_rxbuf,
+				    visca_parse(buffer, numreceived));
+	}
+}
+
+static void visca_upstream_callback(const struct device *dev, void *user_data)
+{
+	while (uart_irq_update(dev) && uart_irq_is_pending(dev)) {
+		if (uart_irq_rx_ready(dev)) {
+			visca_upstream_irq_rx();
+		}
+
+		if (uart_irq_tx_ready(dev)) {
+			visca_link_irq_tx(&upstream);
+		}
+	}
+}
+
+#if VISCA_PROXY
+/* Replies of the camera carry its own address, answer for the head instead */
+static void visca_proxy_readdress(uint8_t *buffer, int len)
+{
+	const uint8_t camera_header =
+		(CONFIG_CAMERAPANTILT_VISCA_PROXY_CAMERA_ADDR + 8) << 4;
+
+	for (int i = 0; i < len; i++) {
+		if (camera_frame_start && (buffer[i] & 0xF0) == camera_header) {
+			buffer[i] = ((proxy_head_addr + 8) << 4) |
+				    (buffer[i] & 0x0F);
+		}
+
+		camera_frame_start = buffer[i] == VISCA_TERMINATOR;
+	}
+}
+
+/* Bounds the acknowledgement, or the reply of an inquiry */
+static void camera_capture_timer_expr(struct k_timer *timer)
+{
+	atomic_set(&camera_capture, CAPTURE_NONE);
+}
+
+static bool visca_proxy_capturing(void)
+{
+	return atomic_get(&camera_capture) != CAPTURE_NONE ||
+	       atomic_get(&camera_swallowed) != 0;
+}
+
+/*
+ * Replies carry the socket of their command. Commands are acknowledged
+ * with the socket first, inquiries are answered on socket 0 right away.
+ * A swallowed command is done with once acknowledged, its completion is
+ * swallowed whenever it arrives. Zooming takes seconds.
+ */
+static bool visca_proxy_reply_is_ours(uint8_t type, int socket)
+{
+	atomic_val_t bit = BIT(socket);
+	enum visca_capture capture = atomic_get(&camera_capture);
+	bool done = type == VISCA_REPLY_COMPLETION ||
+		    type == VISCA_REPLY_ERROR;
+
+	if (done && (atomic_get(&camera_swallowed) & bit)) {
+		atomic_and(&camera_swallowed, ~bit);
+		return true;
+	}
+
+	if (type == VISCA_REPLY_ACK && capture != CAPTURE_NONE &&
+	    camera_socket < 0) {
+		camera_socket = socket;
+
+		if (capture == CAPTURE_SWALLOW) {
+			atomic_or(&camera_swallowed, bit);
+			k_timer_stop(&camera_capture_timer);
+			atomic_set(&camera_capture, CAPTURE_NONE);
+		}
+		return true;
+	}
+
+	if (type == VISCA_REPLY_ACK) {
+		/* the controller got the socket, whatever ran there is done */
+		atomic_and(&camera_swallowed, ~bit);
+		return false;
+	}
+
+	/* errors before the acknowledgement come on socket 0 */
+	if (!done || capture == CAPTURE_NONE ||
+	    (socket != camera_socket && (camera_socket >= 0 || socket != 0))) {
+		return false;
+	}
+
+	k_timer_stop(&camera_capture_timer);
+	if (capture == CAPTURE_REPLY) {
+		memcpy(camera_answer, camera_reply, camera_reply_len);
+		camera_answer_len = camera_reply_len;
+		k_sem_give(&camera_reply_sem);
+	}
+	atomic_set(&camera_capture, CAPTURE_NONE);
+	return true;
+}
+
+/*
+ * Collect replies to requests of the heads instead of passing them on.
+ * Replies to commands of the controller pass on as usual.
+ */
+static void visca_proxy_capture_rx(void)
+{
+	uint8_t data;
+
+	while (visca_proxy_capturing() &&
+	       uart_fifo_read(downstream.uart, &data, 1) == 1) {
+		if (camera_reply_len < ARRAY_SIZE(camera_reply)) {
+			camera_reply[camera_reply_len++] = data;
+		}
+
+		if (data != VISCA_TERMINATOR) {
+			continue;
+		}
+
+		uint8_t type = camera_reply_len > 1 ? camera_reply[1] & 0xF0 :
+						      0;
+		int socket = camera_reply_len > 1 ? camera_reply[1] & 0x0F : 0;
+
+		if (!visca_proxy_reply_is_ours(type, socket)) {
+			visca_proxy_readdress(camera_reply, camera_reply_len);
+			if (visca_link_put(&upstream, &upstream.fwd_buf,
+					   camera_reply, camera_reply_len) != 0) {
+				LOG_ERR("upstream buffer full. Dropping data");
+			}
+		}
+
+		camera_reply_len = 0;
+	}
+}
+#endif
+
+#if VISCA_DOWNSTREAM
+/* Replies of the chain are read straight into the upstream tx buffer */
+static void visca_downstream_irq_rx(void)
+{
+	uint8_t *buffer;
+
+#if VISCA_PROXY
+	if (visca_proxy_capturing()) {
+		visca_proxy_capture_rx();
+		return;
+	}
+#endif
+
+	k_spinlock_key_t key = k_spin_lock(&upstream.lock);
+	uint32_t bsize = ring_buf_put_claim(&upstream.fwd_buf, &buffer,
+					    VISCA_LINK_BUF_SIZE);
+	int rsize = uart_fifo_read(downstream.uart, buffer, bsize);
+
+#if VISCA_PROXY
+	visca_proxy_readdress(buffer, rsize);
+#endif
+	ring_buf_put_finish(&upstream.fwd_buf, rsize);
+	k_spin_unlock(&upstream.lock, key);
+
+	if (rsize > 0) {
+		uart_irq_tx_enable(upstream.uart);
+	} else if (bsize == 0) {
+		uint8_t dummy;
+
+		uart_fifo_read(downstream.uart, &dummy, 1);
+		LOG_ERR("upstream buffer full. Dropping data");
+	}
+}
+
+static void visca_downstream_callback(const struct device *dev,
+				      void *user_data)
+{
+	while (uart_irq_update(dev) && uart_irq_is_pending(dev)) {
+		if (uart_irq_rx_ready(dev)) {
+			visca_downstream_irq_rx();
+		}
+
+		if (uart_irq_tx_ready(dev)) {
+			visca_link_irq_tx(&downstream);
+		}
+	}
+}
+#endif
+
+int visca_port_send(const uint8_t *frame, size_t len)
+{
+	/* a Pelco controller would take replies for commands */
+	if (port_protocol != PROTOCOL_VISCA) {
+		return -ENOTSUP;
+	}
+
+	return visca_link_put(&upstream, &upstream.local_buf, frame, len);
+}
+
+int visca_port_camera_request(const uint8_t *payload, size_t len,
+			      uint8_t *reply, size_t reply_size)
+{
+#if VISCA_PROXY
+	uint8_t frame[VISCA_FRAME_MAX];
+	int rc;
+
+	if (len + 2 > ARRAY_SIZE(frame)) {
+		return -EINVAL;
+	}
+
+	frame[0] = 0x80 | CONFIG_CAMERAPANTILT_VISCA_PROXY_CAMERA_ADDR;
+	memcpy(&frame[1], payload, len);
+	frame[len + 1] = VISCA_TERMINATOR;
+
+	k_mutex_lock(&camera_request_mutex, K_FOREVER);
+	k_sem_reset(&camera_reply_sem);
+	if (!visca_proxy_capturing()) {
+		camera_reply_len = 0;
+	}
+	camera_socket = payload[0] == VISCA_INQUIRY ? 0 : -1;
+	atomic_set(&camera_capture,
+		   reply != NULL ? CAPTURE_REPLY : CAPTURE_SWALLOW);
+	k_timer_start(&camera_capture_timer, K_MSEC(VISCA_CAMERA_TIMEOUT_MS),
+		      K_NO_WAIT);
+
+	rc = visca_link_put(&downstream, &downstream.local_buf, frame,
+			    len + 2);
+
+	if (rc == 0 && reply != NULL) {
+		if (k_sem_take(&camera_reply_sem,
+			       K_MSEC(VISCA_CAMERA_TIMEOUT_MS)) != 0) {
+			LOG_ERR("camera did not answer");
+			atomic_set(&camera_capture, CAPTURE_NONE);
+			rc = -EAGAIN;
+		} else if ((camera_answer[1] & 0xF0) != VISCA_REPLY_COMPLETION) {
+			rc = -EIO;
+		} else {
+			rc = MIN(camera_answer_len, reply_size);
+			memcpy(reply, camera_answer, rc);
+		}
+	}
+
+	k_mutex_unlock(&camera_request_mutex);
+	return rc;
+#else
+	return -ENOTSUP;
+#endif
+}
+
+static int visca_link_init(struct visca_link *link)
+{
+	const struct uart_config visca_uart_config = {
+		.baudrate = 9600,
+		.data_bits = UART_CFG_DATA_BITS_8,
+		.flow_ctrl = UART_CFG_FLOW_CTRL_NONE,
+		.parity = UART_CFG_PARITY_NONE,
+		.stop_bits = UART_CFG_STOP_BITS_1
+	};
+
+	if (!device_is_ready(link->uart)) {
+		LOG_ERR("visca uart %s not ready", link->uart->name);
+		return -ENODEV;
+	}
+
+	if (uart_configure(link->uart, &visca_uart_config) != 0) {
+		LOG_ERR("unable to configure uart for visca");
+		return -EIO;
+	}
+
+	ring_buf_init(&link->fwd_buf, sizeof(link->fwd_data), link->fwd_data);
+	ring_buf_init(&link->local_buf, sizeof(link->local_data),
+		      link->local_data);
+	link->tx_src = NULL;
+	return 0;
+}
+
+int visca_port_init(void)
+{
+	int rc = visca_link_init(&upstream);
+
+	pelco_decoder_init(&pelco_d, PELCO_D);
+	pelco_decoder_init(&pelco_p, PELCO_P);
+
+	if (rc != 0) {
+		return rc;
+	}
+
+#if VISCA_DOWNSTREAM
+	rc = visca_link_init(&downstream);
+
+	if (rc != 0) {
+		return rc;
+	}
+
+	uart_irq_callback_set(downstream.uart, visca_downstream_callback);
+	uart_irq_rx_enable(downstream.uart);
+#endif
+
+	uart_irq_callback_set(upstream.uart, visca_upstream_callback);
+	uart_irq_rx_enable(upstream.uart);
+	return 0;
+}
@@ -0,0 +1,28 @@
+#ifndef CAMPANTILT__VISCA_PORT__H
+#define CAMPANTILT__VISCA_PORT__H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define VISCA_FRAME_MAX 16
+#define VISCA_TERMINATOR 0xFF
+
+/* reply types, the low nibble carries the socket */
+#define VISCA_REPLY_ACK 0x40
+#define VISCA_REPLY_COMPLETION 0x50
+#define VISCA_REPLY_ERROR 0x60
+#define VISCA_ERROR_NOT_EXECUTABLE 0x41
+
+int visca_port_init(void);
+int visca_port_send(const uint8_t *frame, size_t len);
+
+/*
+ * Send a frame body (without address and terminator) to the camera of the
+ * proxy link and wait for its completion or inquiry reply. With reply set
+ * to NULL the request is fire and forget, the replies of the camera are
+ * swallowed. Returns the reply length.
+ */
+int visca_port_camera_request(const uint8_t *payload, size_t len,
+			      uint8_t *reply, size_t reply_size);
+
+#endif
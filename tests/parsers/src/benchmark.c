@@ -0,0 +1,126 @@
+/*
+ * camera pantilt controller
+ *
+ * Copyright (c) Thomas Schmid, 2021
+ *
+ * Authors:
+ *  Thomas Schmid <tom@lfence.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 3.  See
+ * the LICENSE file in the top-level directory.
+ */
+
+/*
+ * Micro benchmarks running every parser over the golden vectors. Each
+ * prints its time per call and fails once it is slower than its baseline
+ * plus CONFIG_PARSER_BENCHMARK_TOLERANCE, or if the target has no baseline
+ * recorded yet.
+ */
+
+#include <ztest.h>
+#include <string.h>
+#include "vectors.h"
+#include "benchmark.h"
+
+#define BENCHMARK_ROUNDS 200
+
+/* keeps the compiler from dropping the parser calls */
+static volatile int sink;
+
+static void benchmark_check(const char *name, uint32_t cycles,
+			    uint32_t calls, uint32_t baseline_ns)
+{
+	uint32_t ns = k_cyc_to_ns_floor64(cycles) / calls;
+	uint32_t limit =
+		baseline_ns * (100 + CONFIG_PARSER_BENCHMARK_TOLERANCE) / 100;
+
+	TC_PRINT("%s: %u ns per call, baseline %u ns\n", name, ns,
+		 baseline_ns);
+	/* an unset baseline would let any regression pass */
+	zassert_true(baseline_ns > 0,
+		     "%s: no baseline for " CONFIG_BOARD
+		     ", record %u ns in boards/" CONFIG_BOARD ".conf",
+		     name, ns);
+	zassert_true(ns <= limit, "%s regressed: %u ns, limit %u ns", name,
+		     ns, limit);
+}
+
+void test_benchmark_visca_frame(void)
+{
+	struct visca_packet_raw raw[visca_vectors_count];
+	struct visca_command cmd;
+	uint32_t start, cycles;
+
+	if (!IS_ENABLED(CONFIG_PARSER_BENCHMARK)) {
+		ztest_test_skip();
+		return;
+	}
+
+	for (int i = 0; i < visca_vectors_count; i++) {
+		raw[i].addr = 0x81;
+		raw[i].length = visca_vectors[i].length;
+		memcpy(raw[i].data, visca_vectors[i].data, sizeof(raw[i].data));
+	}
+
+	start = k_cycle_get_32();
+
+	for (int r = 0; r < BENCHMARK_ROUNDS; r++) {
+		for (int i = 0; i < visca_vectors_count; i++) {
+			sink += visca_raw_packet_to_command(&raw[i], &cmd);
+		}
+	}
+
+	cycles = k_cycle_get_32() - start;
+	benchmark_check("visca frame", cycles,
+			BENCHMARK_ROUNDS * visca_vectors_count,
+			BASELINE_VISCA_FRAME_NS);
+}
+
+void test_benchmark_grbl_response_type(void)
+{
+	uint32_t start, cycles;
+
+	if (!IS_ENABLED(CONFIG_PARSER_BENCHMARK)) {
+		ztest_test_skip();
+		return;
+	}
+
+	start = k_cycle_get_32();
+
+	for (int r = 0; r < BENCHMARK_ROUNDS; r++) {
+		for (int i = 0; i < grbl_type_vectors_count; i++) {
+			sink += grbl_parse_response_type(
+				grbl_type_vectors[i].line);
+		}
+	}
+
+	cycles = k_cycle_get_32() - start;
+	benchmark_check("grbl response type", cycles,
+			BENCHMARK_ROUNDS * grbl_type_vectors_count,
+			BASELINE_GRBL_RESPONSE_TYPE_NS);
+}
+
+void test_benchmark_grbl_report(void)
+{
+	struct GrblState state = { 0 };
+	uint32_t start, cycles;
+
+	if (!IS_ENABLED(CONFIG_PARSER_BENCHMARK)) {
+		ztest_test_skip();
+		return;
+	}
+
+	start = k_cycle_get_32();
+
+	for (int r = 0; r < BENCHMARK_ROUNDS; r++) {
+		for (int i = 0; i < grbl_report_vectors_count; i++) {
+			sink += grbl_parse_report(grbl_report_vectors[i].line,
+						  &state);
+		}
+	}
+
+	cycles = k_cycle_get_32() - start;
+	benchmark_check("grbl report", cycles,
+			BENCHMARK_ROUNDS * grbl_report_vectors_count,
+			BASELINE_GRBL_REPORT_NS);
+}
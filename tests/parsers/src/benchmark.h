@@ -0,0 +1,18 @@
+#ifndef PARSERS__BENCHMARK__H
+#define PARSERS__BENCHMARK__H
+
+/*
+ * Baselines in ns per parsed frame or line, see the PARSER_BENCHMARK_*_NS
+ * options, set per target in boards/<board>.conf. 0 means not measured
+ * yet, the benchmark prints its time and fails.
+ */
+#define BASELINE_VISCA_FRAME_NS CONFIG_PARSER_BENCHMARK_VISCA_FRAME_NS
+#define BASELINE_GRBL_RESPONSE_TYPE_NS                                        \
+	CONFIG_PARSER_BENCHMARK_GRBL_RESPONSE_TYPE_NS
+#define BASELINE_GRBL_REPORT_NS CONFIG_PARSER_BENCHMARK_GRBL_REPORT_NS
+
+void test_benchmark_visca_frame(void);
+void test_benchmark_grbl_response_type(void);
+void test_benchmark_grbl_report(void);
+
+#endif
@@ -0,0 +1,475 @@
+/*
+ * camera pantilt controller
+ *
+ * Copyright (c) Thomas Schmid, 2021
+ *
+ * Authors:
+ *  Thomas Schmid <tom@lfence.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 3.  See
+ * the LICENSE file in the top-level directory.
+ */
+
+/* Golden vectors for the VISCA, Pelco and grbl protocol parsers */
+
+#include <ztest.h>
+#include <string.h>
+#include "vectors.h"
+#include "benchmark.h"
+
+#define JOG(pan_dir, tilt_dir, expected)                                       \
+	{                                                                      \
+		.length = 7,                                                   \
+		.data = { 0x01, 0x06, 0x01, 0x18, 0x14, pan_dir, tilt_dir },   \
+		.cmd = { .cmd = expected,                                      \
+			 .payload.ptd_jog_motion = { 0x18, 0x14 } },           \
+		.payload_size = sizeof(struct visca_ptd_jog_motion),           \
+	}
+
+const struct visca_vector visca_vectors[] = {
+	/* pan: 01 left, 02 right, 03 stop. tilt: 01 up, 02 down, 03 stop */
+	JOG(0x01, 0x01, PTD_UPLEFT),
+	JOG(0x01, 0x02, PTD_DOWNLEFT),
+	JOG(0x01, 0x03, PTD_LEFT),
+	JOG(0x02, 0x01, PTD_UPRIGHT),
+	JOG(0x02, 0x02, PTD_DOWNRIGHT),
+	JOG(0x02, 0x03, PTD_RIGHT),
+	JOG(0x03, 0x01, PTD_UP),
+	JOG(0x03, 0x02, PTD_DOWN),
+	JOG(0x03, 0x03, PTD_STOP),
+	{ .length = 7,
+	  .data = { 0x01, 0x06, 0x01, 0x18, 0x14, 0x04, 0x03 },
+	  .rc = -1 },
+	/* absolute pan 0xF725, tilt 0x0123 */
+	{ .length = 13,
+	  .data = { 0x01, 0x06, 0x02, 0x18, 0x14, 0x0F, 0x07, 0x02, 0x05, 0x00,
+		    0x01, 0x02, 0x03 },
+	  .cmd = { .cmd = PTD_ABS,
+		   .payload.ptd_abs_motion = { 0x18, 0x14, 0xF725, 0x0123 } },
+	  .payload_size = sizeof(struct visca_ptd_abs_rel_motion) },
+	/* relative pan 0x0010, tilt 0xFFF0 */
+	{ .length = 13,
+	  .data = { 0x01, 0x06, 0x03, 0x01, 0x02, 0x00, 0x00, 0x01, 0x00, 0x0F,
+		    0x0F, 0x0F, 0x00 },
+	  .cmd = { .cmd = PTD_REL,
+		   .payload.ptd_rel_motion = { 0x01, 0x02, 0x0010, 0xFFF0 } },
+	  .payload_size = sizeof(struct visca_ptd_abs_rel_motion) },
+	/* same length as a position command but a different category */
+	{ .length = 13,
+	  .data = { 0x01, 0x04, 0x02, 0x18, 0x14, 0x0F, 0x07, 0x02, 0x05, 0x00,
+		    0x01, 0x02, 0x03 },
+	  .rc = -1 },
+	{ .length = 3, .data = { 0x01, 0x06, 0x04 }, .cmd = { .cmd = PTD_HOME } },
+	{ .length = 3,
+	  .data = { 0x01, 0x06, 0x05 },
+	  .cmd = { .cmd = PTD_RESET } },
+	{ .length = 3,
+	  .data = { 0x09, 0x06, 0x12 },
+	  .cmd = { .cmd = PTD_POS_INQ } },
+	{ .length = 5,
+	  .data = { 0x01, 0x04, 0x3F, 0x01, 0x05 },
+	  .cmd = { .cmd = CAM_MEMORY_SET, .payload.cam_memory = { 5 } },
+	  .payload_size = sizeof(struct visca_cam_memory) },
+	{ .length = 5,
+	  .data = { 0x01, 0x04, 0x3F, 0x02, 0x03 },
+	  .cmd = { .cmd = CAM_MEMORY_RECALL, .payload.cam_memory = { 3 } },
+	  .payload_size = sizeof(struct visca_cam_memory) },
+	{ .length = 4,
+	  .data = { 0x01, 0x06, 0x50, 0x01 },
+	  .cmd = { .cmd = PTD_TOUR, .payload.ptd_tour = { 1 } },
+	  .payload_size = sizeof(struct visca_ptd_tour) },
+	{ .length = 4,
+	  .data = { 0x01, 0x06, 0x50, 0x00 },
+	  .cmd = { .cmd = PTD_TOUR, .payload.ptd_tour = { 0 } },
+	  .payload_size = sizeof(struct visca_ptd_tour) },
+	/* zoom tele, not handled by the head */
+	{ .length = 4, .data = { 0x01, 0x04, 0x07, 0x02 }, .rc = -1 },
+	{ .length = 0, .rc = -1 },
+};
+
+const size_t visca_vectors_count = ARRAY_SIZE(visca_vectors);
+
+#define PELCO_JOG(pan_speed, tilt_speed)                                       \
+	.payload.ptd_jog_motion = { pan_speed, tilt_speed }
+
+const struct pelco_vector pelco_vectors[] = {
+	{ PELCO_D,
+	  { 0xFF, 0x01, 0x00, 0x04, 0x20, 0x00, 0x25 },
+	  true,
+	  1,
+	  0,
+	  { .cmd = PTD_LEFT, PELCO_JOG(0x0C, 0x01) },
+	  sizeof(struct visca_ptd_jog_motion) },
+	{ PELCO_D,
+	  { 0xFF, 0x01, 0x00, 0x0A, 0x3F, 0x3F, 0x89 },
+	  true,
+	  1,
+	  0,
+	  { .cmd = PTD_UPRIGHT, PELCO_JOG(0x18, 0x14) },
+	  sizeof(struct visca_ptd_jog_motion) },
+	{ PELCO_D,
+	  { 0xFF, 0x02, 0x00, 0x10, 0x00, 0x10, 0x22 },
+	  true,
+	  2,
+	  0,
+	  { .cmd = PTD_DOWN, PELCO_JOG(0x01, 0x05) },
+	  sizeof(struct visca_ptd_jog_motion) },
+	{ PELCO_D,
+	  { 0xFF, 0x01, 0x00, 0x00, 0x00, 0x00, 0x01 },
+	  true,
+	  1,
+	  0,
+	  { .cmd = PTD_STOP } },
+	/* presets count from 1, memory slots from 0 */
+	{ PELCO_D,
+	  { 0xFF, 0x01, 0x00, 0x03, 0x00, 0x05, 0x09 },
+	  true,
+	  1,
+	  0,
+	  { .cmd = CAM_MEMORY_SET, .payload.cam_memory = { 4 } },
+	  sizeof(struct visca_cam_memory) },
+	{ PELCO_D,
+	  { 0xFF, 0x01, 0x00, 0x07, 0x00, 0x01, 0x09 },
+	  true,
+	  1,
+	  0,
+	  { .cmd = CAM_MEMORY_RECALL, .payload.cam_memory = { 0 } },
+	  sizeof(struct visca_cam_memory) },
+	{ PELCO_D,
+	  { 0xFF, 0x01, 0x00, 0x07, 0x00, 0x00, 0x08 },
+	  true,
+	  1,
+	  -1 },
+	/* left and right at once */
+	{ PELCO_D,
+	  { 0xFF, 0x01, 0x00, 0x06, 0x10, 0x00, 0x17 },
+	  true,
+	  1,
+	  -1 },
+	{ PELCO_D, { 0xFF, 0x01, 0x00, 0x04, 0x20, 0x00, 0x26 }, false },
+	/* Pelco-P addresses count from 0 */
+	{ PELCO_P,
+	  { 0xA0, 0x00, 0x00, 0x04, 0x20, 0x00, 0xAF, 0x2B },
+	  true,
+	  1,
+	  0,
+	  { .cmd = PTD_LEFT, PELCO_JOG(0x0C, 0x01) },
+	  sizeof(struct visca_ptd_jog_motion) },
+	{ PELCO_P,
+	  { 0xA0, 0x02, 0x00, 0x07, 0x00, 0x03, 0xAF, 0x09 },
+	  true,
+	  3,
+	  0,
+	  { .cmd = CAM_MEMORY_RECALL, .payload.cam_memory = { 2 } },
+	  sizeof(struct visca_cam_memory) },
+	{ PELCO_P, { 0xA0, 0x00, 0x00, 0x04, 0x20, 0x00, 0xAE, 0x2A }, false },
+	{ PELCO_P, { 0xA0, 0x00, 0x00, 0x04, 0x20, 0x00, 0xAF, 0x2A }, false },
+};
+
+const size_t pelco_vectors_count = ARRAY_SIZE(pelco_vectors);
+
+const struct grbl_type_vector grbl_type_vectors[] = {
+	{ "ok", GRBL_OK },
+	{ "error:9", GRBL_ERROR },
+	{ "ALARM:1", GRBL_ALARM },
+	{ "<Idle|MPos:0.000,0.000,0.000|FS:0,0>", GRBL_REPORT },
+	{ "[G54:0.000,0.000,0.000]", GRBL_FEEDBACK },
+	{ "[MSG:Reset to continue]", GRBL_FEEDBACK },
+	{ "$110=500.000", GRBL_SETTINGS },
+	{ ">G54:ok", GRBL_STARTUP_EXEC },
+	{ "Grbl 1.1h ['$' for help]", GRBL_WELCOME },
+	/* a prefix of a prefix is no match */
+	{ "", GRBL_INVALID },
+	{ "o", GRBL_INVALID },
+	{ "error", GRBL_INVALID },
+	{ "Alarm:1", GRBL_INVALID },
+	{ "Gr", GRBL_INVALID },
+};
+
+const size_t grbl_type_vectors_count = ARRAY_SIZE(grbl_type_vectors);
+
+const struct grbl_report_vector grbl_report_vectors[] = {
+	{ "<Idle|MPos:1.500,-2.250,0.000|FS:0,0>",
+	  0,
+	  { GRBL_STATE_IDLE, { 1.5f, -2.25f, 0 } } },
+	/* machine position not in the first field */
+	{ "<Run|FS:500,0|MPos:3.000,4.000,5.000>",
+	  0,
+	  { GRBL_STATE_RUN, { 3, 4, 5 } } },
+	{ "<Jog|Bf:15,128|FS:0,0|Pn:XY|MPos:-10.125,-20.5,0.000>",
+	  0,
+	  { GRBL_STATE_JOG, { -10.125f, -20.5f, 0 } } },
+	{ "<Hold:0|MPos:1.000,2.000|FS:0,0>",
+	  0,
+	  { GRBL_STATE_HOLD, { 1, 2, 0 } } },
+	{ "<Home|MPos:0.000,0.000,0.000>",
+	  0,
+	  { GRBL_STATE_HOME, { 0, 0, 0 } } },
+	{ "<Alarm|MPos:7.000,8.000,0.000|WCO:1.000,1.000,0.000>",
+	  0,
+	  { GRBL_STATE_ALARM, { 7, 8, 0 } } },
+	{ "<Sleeping|MPos:1.000,1.000,1.000>",
+	  0,
+	  { GRBL_STATE_UNKNOWN, { 1, 1, 1 } } },
+	/* rejected reports leave the state untouched */
+	{ "<Idle|MPos:1.000|FS:0,0>", -EINVAL, { 0 } },
+	{ "<Idle|MPos:|FS:0,0>", -EINVAL, { 0 } },
+	{ "<Idle>", -EINVAL, { 0 } },
+	{ "Idle|MPos:1.000,2.000,3.000", -EINVAL, { 0 } },
+};
+
+const size_t grbl_report_vectors_count = ARRAY_SIZE(grbl_report_vectors);
+
+static void test_visca_frames(void)
+{
+	for (int i = 0; i < visca_vectors_count; i++) {
+		const struct visca_vector *v = &visca_vectors[i];
+		struct visca_packet_raw raw = { .addr = 0x81,
+						.length = v->length };
+		struct visca_command cmd;
+		int rc;
+
+		memcpy(raw.data, v->data, sizeof(raw.data));
+		memset(&cmd, 0, sizeof(cmd));
+		rc = visca_raw_packet_to_command(&raw, &cmd);
+
+		zassert_equal(rc, v->rc, "vector %d: rc %d", i, rc);
+
+		if (v->rc != 0) {
+			continue;
+		}
+
+		zassert_equal(cmd.cmd, v->cmd.cmd, "vector %d: cmd %d", i,
+			      cmd.cmd);
+		zassert_mem_equal(&cmd.payload, &v->cmd.payload,
+				  v->payload_size, "vector %d: payload", i);
+	}
+}
+
+static void test_visca_nibbles(void)
+{
+	static const uint16_t values[] = { 0x0000, 0x0001, 0x1234, 0x8000,
+					   0xF725, 0xFFFF };
+	uint8_t data[4];
+
+	for (int i = 0; i < ARRAY_SIZE(values); i++) {
+		visca_encode_nibbles(values[i], data);
+
+		for (int n = 0; n < ARRAY_SIZE(data); n++) {
+			zassert_true(data[n] <= 0x0F, "0x%04x: byte %d",
+				     values[i], n);
+		}
+
+		zassert_equal(visca_decode_nibbles(data), values[i], "0x%04x",
+			      values[i]);
+	}
+
+	/* the high nibble is ignored */
+	data[0] = 0xF1;
+	data[1] = 0x02;
+	data[2] = 0x33;
+	data[3] = 0x04;
+	zassert_equal(visca_decode_nibbles(data), 0x1234, NULL);
+}
+
+static void test_pelco_frames(void)
+{
+	for (int i = 0; i < pelco_vectors_count; i++) {
+		const struct pelco_vector *v = &pelco_vectors[i];
+		size_t size = v->variant == PELCO_D ? PELCO_D_FRAME_SIZE :
+						      PELCO_P_FRAME_SIZE;
+		struct pelco_decoder dec;
+		struct visca_command cmd;
+		uint8_t addr;
+		bool complete = false;
+		int rc;
+
+		pelco_decoder_init(&dec, v->variant);
+
+		for (int n = 0; n < size; n++) {
+			zassert_false(complete, "vector %d: early end", i);
+			complete = pelco_decoder_feed(&dec, v->frame[n]);
+		}
+
+		zassert_equal(complete, v->valid, "vector %d: checksum", i);
+
+		if (!v->valid) {
+			continue;
+		}
+
+		zassert_true(pelco_decoder_addr(&dec, &addr), NULL);
+		zassert_equal(addr, v->addr, "vector %d: addr %d", i, addr);
+
+		memset(&cmd, 0, sizeof(cmd));
+		rc = pelco_frame_to_command(&dec, &cmd);
+		zassert_equal(rc, v->rc, "vector %d: rc %d", i, rc);
+
+		if (v->rc != 0) {
+			continue;
+		}
+
+		zassert_equal(cmd.cmd, v->cmd.cmd, "vector %d: cmd %d", i,
+			      cmd.cmd);
+		zassert_mem_equal(&cmd.payload, &v->cmd.payload,
+				  v->payload_size, "vector %d: payload", i);
+	}
+}
+
+/* Sync bytes inside data must not lose the frame that follows */
+static void test_pelco_resync(void)
+{
+	static const uint8_t stream[] = { 0x12, 0xFF, 0x01, 0xFF, 0x01, 0x00,
+					  0x04, 0x20, 0x00, 0x25 };
+	struct pelco_decoder dec;
+	int frames = 0;
+
+	pelco_decoder_init(&dec, PELCO_D);
+
+	for (int i = 0; i < ARRAY_SIZE(stream); i++) {
+		if (pelco_decoder_feed(&dec, stream[i])) {
+			zassert_equal(i, ARRAY_SIZE(stream) - 1, NULL);
+			frames++;
+		}
+	}
+
+	zassert_equal(frames, 1, NULL);
+}
+
+static void test_grbl_response_type(void)
+{
+	for (int i = 0; i < grbl_type_vectors_count; i++) {
+		const struct grbl_type_vector *v = &grbl_type_vectors[i];
+
+		zassert_equal(grbl_parse_response_type(v->line), v->type,
+			      "\"%s\"", v->line);
+	}
+}
+
+static void test_grbl_ctrl_state(void)
+{
+	zassert_equal(grbl_parse_ctrl_state("Idle|MPos"), GRBL_STATE_IDLE,
+		      NULL);
+	zassert_equal(grbl_parse_ctrl_state("Hold:1|MPos"), GRBL_STATE_HOLD,
+		      NULL);
+	zassert_equal(grbl_parse_ctrl_state("Door:2|MPos"), GRBL_STATE_DOOR,
+		      NULL);
+	zassert_equal(grbl_parse_ctrl_state("Check"), GRBL_STATE_CHECK, NULL);
+	zassert_equal(grbl_parse_ctrl_state("Sleep>"), GRBL_STATE_SLEEP, NULL);
+	zassert_equal(grbl_parse_ctrl_state(""), GRBL_STATE_UNKNOWN, NULL);
+	zassert_equal(grbl_parse_ctrl_state("Id"), GRBL_STATE_UNKNOWN, NULL);
+	zassert_equal(grbl_parse_ctrl_state("Idler"), GRBL_STATE_UNKNOWN,
+		      NULL);
+
+	for (int i = 0; i <= GRBL_STATE_UNKNOWN; i++) {
+		const char *name = grbl_state_to_str(i);
+
+		if (i != GRBL_STATE_UNKNOWN) {
+			zassert_equal(grbl_parse_ctrl_state(name), i, "%s",
+				      name);
+		}
+	}
+}
+
+static void test_grbl_report(void)
+{
+	for (int i = 0; i < grbl_report_vectors_count; i++) {
+		const struct grbl_report_vector *v = &grbl_report_vectors[i];
+		const struct GrblState untouched = { GRBL_STATE_CHECK,
+						     { 42, 42, 42 } };
+		struct GrblState state = untouched;
+		int rc = grbl_parse_report(v->line, &state);
+
+		zassert_equal(rc, v->rc, "\"%s\": rc %d", v->line, rc);
+
+		if (rc != 0) {
+			zassert_mem_equal(&state, &untouched, sizeof(state),
+					  "\"%s\"", v->line);
+			continue;
+		}
+
+		zassert_equal(state.state, v->state.state, "\"%s\"", v->line);
+		zassert_within(state.pos_act.x, v->state.pos_act.x, 0.0005f,
+			       "\"%s\"", v->line);
+		zassert_within(state.pos_act.y, v->state.pos_act.y, 0.0005f,
+			       "\"%s\"", v->line);
+		zassert_within(state.pos_act.z, v->state.pos_act.z, 0.0005f,
+			       "\"%s\"", v->line);
+	}
+}
+
+static void test_grbl_alarm(void)
+{
+	zassert_equal(grbl_parse_alarm("ALARM:1"), 1, NULL);
+	zassert_equal(grbl_parse_alarm("ALARM:9"), 9, NULL);
+	zassert_equal(grbl_parse_alarm("Alarm:1"), -EINVAL, NULL);
+	zassert_equal(grbl_parse_alarm("ok"), -EINVAL, NULL);
+}
+
+static void test_grbl_settings(void)
+{
+	struct GrblSettings settings = { 0 };
+
+	zassert_equal(grbl_parse_setting("$110=500.000", &settings), 0, NULL);
+	zassert_equal(grbl_parse_setting("$111=250.5", &settings), 0, NULL);
+	zassert_equal(grbl_parse_setting("$120=10.000", &settings), 0, NULL);
+	zassert_equal(grbl_parse_setting("$131=180.000", &settings), 0, NULL);
+	zassert_equal(grbl_parse_setting("$132=90.000", &settings), 0, NULL);
+	zassert_equal(grbl_parse_setting("$13=0", &settings), 0, NULL);
+	zassert_equal(grbl_parse_setting("$N0=G54", &settings), -EINVAL,
+		      NULL);
+	zassert_equal(grbl_parse_setting("$$", &settings), -EINVAL, NULL);
+	zassert_equal(grbl_parse_setting("ok", &settings), -EINVAL, NULL);
+
+	zassert_within(settings.max_rate[0], 500.0f, 0.0005f, NULL);
+	zassert_within(settings.max_rate[1], 250.5f, 0.0005f, NULL);
+	zassert_within(settings.accel[0], 10.0f, 0.0005f, NULL);
+	zassert_within(settings.max_travel[1], 180.0f, 0.0005f, NULL);
+	zassert_within(settings.max_travel[2], 90.0f, 0.0005f, NULL);
+	/* $13 is report inches, not an axis setting */
+	zassert_within(settings.accel[1], 0.0f, 0.0005f, NULL);
+}
+
+static void test_grbl_work_offsets(void)
+{
+	struct WorkOffset offsets[GRBL_WORK_OFFSETS] = { 0 };
+
+	zassert_equal(grbl_parse_work_offset("[G54:1.000,-2.000,3.000]",
+					     offsets),
+		      0, NULL);
+	zassert_equal(grbl_parse_work_offset("[G59:4.000,5.000,6.000]",
+					     offsets),
+		      5, NULL);
+	zassert_equal(grbl_parse_work_offset("[G30:7.000,8.000,9.000]",
+					     offsets),
+		      7, NULL);
+	zassert_equal(grbl_parse_work_offset("[G28:]", offsets), -EINVAL,
+		      NULL);
+	zassert_equal(grbl_parse_work_offset("[GC:G0 G54 G17]", offsets),
+		      -EINVAL, NULL);
+	zassert_equal(grbl_parse_work_offset("[G92:0.000,0.000,0.000]",
+					     offsets),
+		      -EINVAL, NULL);
+
+	zassert_equal(offsets[5].wco_num, 5, NULL);
+	zassert_within(offsets[0].offset.y, -2.0f, 0.0005f, NULL);
+	zassert_within(offsets[5].offset.z, 6.0f, 0.0005f, NULL);
+	zassert_within(offsets[7].offset.x, 7.0f, 0.0005f, NULL);
+}
+
+void test_main(void)
+{
+	ztest_test_suite(parsers, ztest_unit_test(test_visca_frames),
+			 ztest_unit_test(test_visca_nibbles),
+			 ztest_unit_test(test_pelco_frames),
+			 ztest_unit_test(test_pelco_resync),
+			 ztest_unit_test(test_grbl_response_type),
+			 ztest_unit_test(test_grbl_ctrl_state),
+			 ztest_unit_test(test_grbl_report),
+			 ztest_unit_test(test_grbl_alarm),
+			 ztest_unit_test(test_grbl_settings),
+			 ztest_unit_test(test_grbl_work_offsets),
+			 ztest_unit_test(test_benchmark_visca_frame),
+			 ztest_unit_test(test_benchmark_grbl_response_type),
+			 ztest_unit_test(test_benchmark_grbl_report));
+	ztest_run_test_suite(parsers);
+}
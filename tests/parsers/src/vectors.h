@@ -0,0 +1,52 @@
+#ifndef PARSERS__VECTORS__H
+#define PARSERS__VECTORS__H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "visca.h"
+#include "pelco.h"
+#include "grbl_parser.h"
+
+/* frame body without address and terminator */
+struct visca_vector {
+	uint8_t length;
+	uint8_t data[14];
+	int rc;
+	struct visca_command cmd;
+	/* bytes of cmd.payload to compare */
+	size_t payload_size;
+};
+
+/* a complete frame including sync and checksum */
+struct pelco_vector {
+	enum pelco_variant variant;
+	uint8_t frame[PELCO_P_FRAME_SIZE];
+	/* false if the decoder has to reject the checksum */
+	bool valid;
+	uint8_t addr;
+	int rc;
+	struct visca_command cmd;
+	size_t payload_size;
+};
+
+struct grbl_type_vector {
+	const char *line;
+	enum grbl_message type;
+};
+
+struct grbl_report_vector {
+	const char *line;
+	int rc;
+	struct GrblState state;
+};
+
+extern const struct visca_vector visca_vectors[];
+extern const size_t visca_vectors_count;
+extern const struct pelco_vector pelco_vectors[];
+extern const size_t pelco_vectors_count;
+extern const struct grbl_type_vector grbl_type_vectors[];
+extern const size_t grbl_type_vectors_count;
+extern const struct grbl_report_vector grbl_report_vectors[];
+extern const size_t grbl_report_vectors_count;
+
+#endif